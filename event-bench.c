@@ -0,0 +1,625 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event-bench.c: Benchmark for the event loop backends
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * standalone benchmark for event.c and its backends. for each number of event
+ * sources it creates that many pipes (or socketpairs) and measures:
+ *
+ * - the cost of event_loop_add_source and of removing the event sources again
+ * - the wakeup-to-callback latency: another thread writes to a random pipe
+ *   while the event loop is blocked waiting for events
+ * - the dispatch throughput: all pipes stay readable, so every iteration of
+ *   the event loop dispatches all event sources
+ * - the user space cache misses per dispatch during the throughput
+ *   measurement, if perf events are available (Linux only, might require
+ *   kernel.perf_event_paranoid <= 2), otherwise -1 is reported
+ * - the cost of event_loop_modify_source churn, toggling EVENT_WRITE on and
+ *   off like Writer does when its backlog fills and drains
+ *
+ * the results are written to stdout as CSV, one line per number of event
+ * sources, so results of different backends and releases can be compared.
+ * the backend is selected at compile time, build one binary per backend:
+ *
+ *   COMMON="event.c timer_wheel.c slab.c array.c hash_table.c pipe_posix.c
+ *           utils.c threads_posix.c io.c node.c -lpthread"
+ *
+ *   gcc -O2 -DDAEMONLIB_WITH_EPOLL -o event-bench-epoll event-bench.c event_linux.c $COMMON
+ *   gcc -O2 -o event-bench-poll event-bench.c event_posix.c $COMMON
+ *   gcc -O2 -DDAEMONLIB_WITH_EPOLL -DDAEMONLIB_WITH_IO_URING -o event-bench-io_uring \
+ *       event-bench.c event_io_uring.c event_linux.c $COMMON -luring
+ *
+ * usage:
+ *
+ *   event-bench [--sources <n>[,<n>...]] [--samples <n>] [--socketpair] [--no-header]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+#endif
+
+#include "event.h"
+#include "threads.h"
+
+#if defined DAEMONLIB_WITH_IO_URING
+	#define BACKEND_NAME "io_uring"
+#elif defined __linux__ && defined DAEMONLIB_WITH_EPOLL
+	#define BACKEND_NAME "epoll"
+#else
+	#define BACKEND_NAME "poll"
+#endif
+
+#define DEFAULT_SOURCE_COUNTS "1,10,100,1000,10000,100000"
+#define DEFAULT_SAMPLE_COUNT 1000
+#define MIN_DISPATCH_COUNT 1000000 // per throughput measurement
+#define MIN_MODIFY_COUNT 100000 // per churn measurement
+#define LATENCY_PAUSE 50 // microseconds between two latency samples
+
+typedef struct {
+	int read_fd;
+	int write_fd;
+} BenchPipe;
+
+typedef struct {
+	EventLoop *loop;
+	BenchPipe *pipes;
+	int pipe_count;
+	int sample_count;
+	uint64_t *latencies; // nanoseconds
+	uint64_t written_at; // nanoseconds, of the current latency sample
+	int handled_count;
+	uint64_t dispatch_count;
+	uint64_t dispatch_target;
+} Bench;
+
+typedef struct {
+	double add; // nanoseconds per event source
+	double remove; // nanoseconds per event source
+	uint64_t latency_p50; // nanoseconds
+	uint64_t latency_p99; // nanoseconds
+	uint64_t latency_max; // nanoseconds
+	double dispatch_rate; // dispatches per second
+	double dispatch_cache_misses; // per dispatch, -1 if not available
+	double modify; // nanoseconds per event_loop_modify_source call
+} BenchResult;
+
+static Bench _bench;
+
+static uint64_t nanotime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// returns -1 if the cache miss counter is not available
+static int cache_miss_counter_open(void) {
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1; // only count misses caused by the event loop itself
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void cache_miss_counter_start(int fd) {
+#ifdef __linux__
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void)fd;
+#endif
+}
+
+// returns -1 if the cache miss counter is not available
+static int64_t cache_miss_counter_stop(int fd) {
+#ifdef __linux__
+	uint64_t count;
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		return -1;
+	}
+
+	return (int64_t)count;
+#else
+	(void)fd;
+
+	return -1;
+#endif
+}
+
+static void handle_cleanup(void) {
+}
+
+static void handle_latency_read(void *opaque) {
+	BenchPipe *bench_pipe = opaque;
+	uint64_t now;
+	uint8_t byte;
+
+	if (read(bench_pipe->read_fd, &byte, 1) != 1) {
+		return;
+	}
+
+	now = nanotime();
+
+	_bench.latencies[_bench.handled_count] =
+		now - __atomic_load_n(&_bench.written_at, __ATOMIC_ACQUIRE);
+
+	__atomic_store_n(&_bench.handled_count, _bench.handled_count + 1, __ATOMIC_RELEASE);
+}
+
+static void handle_dispatch_read(void *opaque) {
+	(void)opaque;
+
+	// don't read, so the event source stays readable
+	if (++_bench.dispatch_count == _bench.dispatch_target) {
+		event_loop_stop(_bench.loop);
+	}
+}
+
+static void handle_write(void *opaque) {
+	(void)opaque;
+}
+
+// writes to random pipes from another thread, while the event loop is
+// waiting for events
+static void latency_driver(void *opaque) {
+	int i;
+	BenchPipe *bench_pipe;
+	uint8_t byte = 0;
+
+	(void)opaque;
+
+	for (i = 0; i < _bench.sample_count; ++i) {
+		// give the event loop time to block in its wait again
+		microsleep(LATENCY_PAUSE);
+
+		bench_pipe = &_bench.pipes[rand() % _bench.pipe_count];
+
+		__atomic_store_n(&_bench.written_at, nanotime(), __ATOMIC_RELEASE);
+
+		if (write(bench_pipe->write_fd, &byte, 1) != 1) {
+			fprintf(stderr, "Could not write to pipe: %s\n", strerror(errno));
+
+			break;
+		}
+
+		while (__atomic_load_n(&_bench.handled_count, __ATOMIC_ACQUIRE) <= i) {
+			// spin
+		}
+	}
+
+	event_loop_stop(_bench.loop);
+}
+
+// returns -1 on error or 0 on success
+static int create_pipes(BenchPipe *pipes, int count, bool socketpairs) {
+	int i;
+	int fds[2];
+
+	for (i = 0; i < count; ++i) {
+		if (socketpairs) {
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+				break;
+			}
+		} else if (pipe(fds) < 0) {
+			break;
+		}
+
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+		pipes[i].read_fd = fds[0];
+		pipes[i].write_fd = fds[1];
+	}
+
+	if (i < count) {
+		fprintf(stderr, "Could not create pipe %d of %d: %s\n", i + 1, count, strerror(errno));
+
+		while (--i >= 0) {
+			close(pipes[i].read_fd);
+			close(pipes[i].write_fd);
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void destroy_pipes(BenchPipe *pipes, int count) {
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		close(pipes[i].read_fd);
+		close(pipes[i].write_fd);
+	}
+}
+
+// returns -1 on error or 0 on success
+static int add_sources(EventLoop *loop, BenchPipe *pipes, int count, EventFunction function) {
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (event_loop_add_source(loop, pipes[i].read_fd, EVENT_SOURCE_TYPE_GENERIC,
+		                          "bench", EVENT_READ, function, &pipes[i]) < 0) {
+			fprintf(stderr, "Could not add event source %d of %d\n", i + 1, count);
+
+			return -1;
+		}
+	}
+
+	// mark the added event sources as normal, otherwise they are ignored
+	event_loop_cleanup_sources(loop);
+
+	return 0;
+}
+
+static void remove_sources(EventLoop *loop, BenchPipe *pipes, int count) {
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		event_loop_remove_source(loop, pipes[i].read_fd, EVENT_SOURCE_TYPE_GENERIC);
+	}
+
+	event_loop_cleanup_sources(loop);
+}
+
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t latency_a = *(const uint64_t *)a;
+	uint64_t latency_b = *(const uint64_t *)b;
+
+	return latency_a < latency_b ? -1 : (latency_a > latency_b ? 1 : 0);
+}
+
+// measures adding and removing event sources and the wakeup latency.
+//
+// returns -1 on error or 0 on success
+static int measure_latency(BenchResult *result) {
+	EventLoop loop;
+	Thread thread;
+	uint64_t started;
+	int count;
+
+	if (event_loop_create(&loop) < 0) {
+		return -1;
+	}
+
+	_bench.loop = &loop;
+	_bench.handled_count = 0;
+
+	started = nanotime();
+
+	if (add_sources(&loop, _bench.pipes, _bench.pipe_count, handle_latency_read) < 0) {
+		event_loop_destroy(&loop);
+
+		return -1;
+	}
+
+	result->add = (double)(nanotime() - started) / _bench.pipe_count;
+
+	thread_create(&thread, latency_driver, NULL);
+
+	event_loop_run(&loop, handle_cleanup);
+
+	thread_join(&thread);
+	thread_destroy(&thread);
+
+	count = _bench.handled_count;
+
+	if (count > 0) {
+		qsort(_bench.latencies, count, sizeof(uint64_t), compare_latencies);
+
+		result->latency_p50 = _bench.latencies[(count - 1) * 50 / 100];
+		result->latency_p99 = _bench.latencies[(count - 1) * 99 / 100];
+		result->latency_max = _bench.latencies[count - 1];
+	}
+
+	started = nanotime();
+
+	remove_sources(&loop, _bench.pipes, _bench.pipe_count);
+
+	result->remove = (double)(nanotime() - started) / _bench.pipe_count;
+
+	event_loop_destroy(&loop);
+
+	return count == _bench.sample_count ? 0 : -1;
+}
+
+// measures how many ready event sources are dispatched per second and how
+// many cache misses each dispatch causes.
+//
+// returns -1 on error or 0 on success
+static int measure_dispatch(BenchResult *result) {
+	EventLoop loop;
+	uint64_t started;
+	int counter_fd;
+	int64_t cache_misses;
+	uint64_t iterations = (MIN_DISPATCH_COUNT + _bench.pipe_count - 1) / _bench.pipe_count;
+	uint8_t byte = 0;
+	int i;
+
+	for (i = 0; i < _bench.pipe_count; ++i) {
+		if (write(_bench.pipes[i].write_fd, &byte, 1) != 1) {
+			fprintf(stderr, "Could not write to pipe: %s\n", strerror(errno));
+
+			return -1;
+		}
+	}
+
+	if (event_loop_create(&loop) < 0) {
+		return -1;
+	}
+
+	_bench.loop = &loop;
+	_bench.dispatch_count = 0;
+	_bench.dispatch_target = iterations * _bench.pipe_count;
+
+	if (add_sources(&loop, _bench.pipes, _bench.pipe_count, handle_dispatch_read) < 0) {
+		event_loop_destroy(&loop);
+
+		return -1;
+	}
+
+	counter_fd = cache_miss_counter_open();
+
+	started = nanotime();
+
+	cache_miss_counter_start(counter_fd);
+
+	event_loop_run(&loop, handle_cleanup);
+
+	cache_misses = cache_miss_counter_stop(counter_fd);
+
+	result->dispatch_rate = (double)_bench.dispatch_count * 1000000000.0 / (nanotime() - started);
+	result->dispatch_cache_misses = cache_misses < 0 ? -1 : (double)cache_misses / _bench.dispatch_count;
+
+	if (counter_fd >= 0) {
+		close(counter_fd);
+	}
+
+	remove_sources(&loop, _bench.pipes, _bench.pipe_count);
+	event_loop_destroy(&loop);
+
+	for (i = 0; i < _bench.pipe_count; ++i) {
+		if (read(_bench.pipes[i].read_fd, &byte, 1) != 1) {
+			fprintf(stderr, "Could not read from pipe: %s\n", strerror(errno));
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// measures toggling EVENT_WRITE on and off.
+//
+// returns -1 on error or 0 on success
+static int measure_modify(BenchResult *result) {
+	EventLoop loop;
+	uint64_t started;
+	int count = _bench.pipe_count > MIN_MODIFY_COUNT / 2 ? _bench.pipe_count : MIN_MODIFY_COUNT / 2;
+	int i;
+	int fd;
+
+	if (event_loop_create(&loop) < 0) {
+		return -1;
+	}
+
+	if (add_sources(&loop, _bench.pipes, _bench.pipe_count, handle_latency_read) < 0) {
+		event_loop_destroy(&loop);
+
+		return -1;
+	}
+
+	started = nanotime();
+
+	for (i = 0; i < count; ++i) {
+		fd = _bench.pipes[i % _bench.pipe_count].read_fd;
+
+		if (event_loop_modify_source(&loop, fd, EVENT_SOURCE_TYPE_GENERIC, 0,
+		                             EVENT_WRITE, handle_write, NULL) < 0 ||
+		    event_loop_modify_source(&loop, fd, EVENT_SOURCE_TYPE_GENERIC, EVENT_WRITE,
+		                             0, NULL, NULL) < 0) {
+			fprintf(stderr, "Could not modify event source\n");
+
+			break;
+		}
+	}
+
+	result->modify = (double)(nanotime() - started) / (2.0 * count);
+
+	remove_sources(&loop, _bench.pipes, _bench.pipe_count);
+	event_loop_destroy(&loop);
+
+	return i == count ? 0 : -1;
+}
+
+// raises the file descriptor limit as far as allowed.
+//
+// returns the maximum number of pipes that can be created
+static int raise_fd_limit(void) {
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		return 0;
+	}
+
+	if (limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// reserve some file descriptors for the event loops and stdio
+	return limit.rlim_cur > 64 ? (int)((limit.rlim_cur - 64) / 2) : 0;
+}
+
+static void print_usage(const char *name) {
+	fprintf(stderr, "usage: %s [--sources <n>[,<n>...]] [--samples <n>] [--socketpair] [--no-header]\n",
+	        name);
+}
+
+int main(int argc, char **argv) {
+	const char *source_counts = DEFAULT_SOURCE_COUNTS;
+	const char *p;
+	char *end;
+	bool socketpairs = false;
+	bool header = true;
+	int max_pipe_count;
+	int i;
+	BenchResult result;
+	int rc = 0;
+
+	_bench.sample_count = DEFAULT_SAMPLE_COUNT;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--sources") == 0 && i + 1 < argc) {
+			source_counts = argv[++i];
+		} else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+			_bench.sample_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--socketpair") == 0) {
+			socketpairs = true;
+		} else if (strcmp(argv[i], "--no-header") == 0) {
+			header = false;
+		} else {
+			print_usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (_bench.sample_count <= 0) {
+		print_usage(argv[0]);
+
+		return 1;
+	}
+
+	_bench.latencies = calloc(_bench.sample_count, sizeof(uint64_t));
+
+	if (_bench.latencies == NULL) {
+		fprintf(stderr, "Could not allocate latency samples\n");
+
+		return 1;
+	}
+
+	max_pipe_count = raise_fd_limit();
+
+	if (header) {
+		printf("backend,transport,sources,add_nsec,remove_nsec,latency_p50_nsec,"
+		       "latency_p99_nsec,latency_max_nsec,dispatch_per_sec,dispatch_cache_misses,"
+		       "modify_nsec\n");
+	}
+
+	for (p = source_counts; *p != '\0'; p = *end == ',' ? end + 1 : end) {
+		_bench.pipe_count = (int)strtol(p, &end, 10);
+
+		if (end == p || _bench.pipe_count <= 0) {
+			print_usage(argv[0]);
+
+			rc = 1;
+
+			break;
+		}
+
+		if (_bench.pipe_count > max_pipe_count) {
+			fprintf(stderr, "Skipping %d event sources, file descriptor limit allows only %d\n",
+			        _bench.pipe_count, max_pipe_count);
+
+			continue;
+		}
+
+		_bench.pipes = calloc(_bench.pipe_count, sizeof(BenchPipe));
+
+		if (_bench.pipes == NULL) {
+			fprintf(stderr, "Could not allocate %d pipes\n", _bench.pipe_count);
+
+			rc = 1;
+
+			break;
+		}
+
+		if (create_pipes(_bench.pipes, _bench.pipe_count, socketpairs) < 0) {
+			free(_bench.pipes);
+
+			rc = 1;
+
+			break;
+		}
+
+		memset(&result, 0, sizeof(result));
+
+		if (measure_latency(&result) < 0 ||
+		    measure_dispatch(&result) < 0 ||
+		    measure_modify(&result) < 0) {
+			fprintf(stderr, "Benchmark failed for %d event sources\n", _bench.pipe_count);
+
+			rc = 1;
+		} else {
+			printf("%s,%s,%d,%.1f,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.0f,%.3f,%.1f\n",
+			       BACKEND_NAME, socketpairs ? "socketpair" : "pipe", _bench.pipe_count,
+			       result.add, result.remove, result.latency_p50, result.latency_p99,
+			       result.latency_max, result.dispatch_rate, result.dispatch_cache_misses,
+			       result.modify);
+
+			fflush(stdout);
+		}
+
+		destroy_pipes(_bench.pipes, _bench.pipe_count);
+		free(_bench.pipes);
+	}
+
+	free(_bench.latencies);
+
+	return rc;
+}
@@ -21,29 +21,56 @@
  */
 
 #include <errno.h>
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	#include <inttypes.h>
+	#include <stdio.h>
+#endif
+#include <stdlib.h>
 #include <string.h>
+#ifdef __linux__
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#endif
 
 #include "event.h"
 
 #include "array.h"
+#include "hash_table.h"
 #include "log.h"
+#include "macros.h"
+#include "node.h"
 #include "pipe.h"
+#include "slab.h"
+#include "threads.h"
+#include "timer_wheel.h"
 #include "utils.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-static bool _running;
-static bool _stop_requested;
-static Array _event_sources;
-static Pipe _stop_pipe;
+STATIC_ASSERT(sizeof(EventSource) <= SLAB_ALIGNMENT, "EventSource does not fit into a cache line")
 
-extern int event_init_platform(void);
-extern void event_exit_platform(void);
-extern int event_source_added_platform(EventSource *event_source);
-extern int event_source_modified_platform(EventSource *event_source);
-extern void event_source_removed_platform(EventSource *event_source);
-extern int event_run_platform(Array *sources, bool *running,
-                              EventCleanupFunction cleanup);
+typedef struct {
+	EventLoop loop;
+	Thread thread;
+} EventWorker;
+
+struct _EventTask {
+	EventTask *next;
+	EventFunction function;
+	void *opaque;
+};
+
+static EventLoop _default_loop;
+static Array _workers; // EventWorker, not relocatable
+static int _next_loop; // for round-robin assignment of event sources
+static THREAD_LOCAL EventLoop *_current_loop = NULL;
+
+extern int event_init_platform(EventLoop *loop);
+extern void event_exit_platform(EventLoop *loop);
+extern int event_source_added_platform(EventLoop *loop, EventSource *event_source);
+extern int event_source_modified_platform(EventLoop *loop, EventSource *event_source);
+extern void event_source_removed_platform(EventLoop *loop, EventSource *event_source);
+extern int event_run_platform(EventLoop *loop, EventCleanupFunction cleanup);
 
 const char *event_get_source_type_name(EventSourceType type, bool upper) {
 	switch (type) {
@@ -55,33 +82,245 @@ const char *event_get_source_type_name(EventSourceType type, bool upper) {
 }
 
 int event_init(void) {
+	log_debug("Initializing event subsystem");
+
+	_next_loop = 0;
+
+	// create worker array, the EventWorker struct is not relocatable because
+	// the event sources and the thread of a worker store pointers to it
+	if (array_create(&_workers, 4, sizeof(EventWorker), false) < 0) {
+		log_error("Could not create event worker array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (event_loop_create(&_default_loop) < 0) {
+		array_destroy(&_workers, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void event_exit(void) {
+	int i;
+
+	log_debug("Shutting down event subsystem");
+
+	for (i = _workers.count - 1; i >= 0; --i) {
+		event_loop_destroy(&((EventWorker *)array_get(&_workers, i))->loop);
+	}
+
+	array_destroy(&_workers, NULL);
+
+	event_loop_destroy(&_default_loop);
+}
+
+// creates COUNT additional event loops. event_run starts a thread for each of
+// them and runs them next to the default event loop. before event_run is
+// called, event sources can be assigned to any event loop with event_get_loop.
+// afterwards an event loop should only be modified by its own thread. the
+// event_*_source functions operate on the event loop run by the calling thread
+//
+// returns -1 on error or 0 on success
+int event_create_worker_loops(int count) {
+	int i;
+	EventWorker *worker;
+
+	for (i = 0; i < count; ++i) {
+		worker = array_append(&_workers);
+
+		if (worker == NULL) {
+			log_error("Could not append to event worker array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		if (event_loop_create(&worker->loop) < 0) {
+			array_remove(&_workers, _workers.count - 1, NULL);
+
+			return -1;
+		}
+	}
+
+	log_debug("Created %d event worker loop(s), %d in total", count, _workers.count);
+
+	return 0;
+}
+
+EventLoop *event_get_default_loop(void) {
+	return &_default_loop;
+}
+
+// returns the event loop run by the calling thread, or the default event loop
+// if the calling thread doesn't run an event loop
+EventLoop *event_get_current_loop(void) {
+	return _current_loop != NULL ? _current_loop : &_default_loop;
+}
+
+// returns the event loop to be used for a new event source. the default event
+// loop and all worker loops are used in turn if HINT is EVENT_LOOP_ROUND_ROBIN.
+// otherwise HINT (>= 0) selects the event loop. this allows to keep related
+// event sources in the same event loop
+EventLoop *event_get_loop(int hint) {
+	int count = 1 + _workers.count;
+
+	if (hint < 0) {
+		hint = _next_loop;
+		_next_loop = (_next_loop + 1) % count;
+	}
+
+	hint %= count;
+
+	if (hint == 0) {
+		return &_default_loop;
+	}
+
+	return &((EventWorker *)array_get(&_workers, hint - 1))->loop;
+}
+
+static IOHandle event_get_wakeup_handle(EventLoop *loop) {
+#ifdef __linux__
+	return loop->wakeup_eventfd;
+#else
+	return loop->wakeup_pipe.base.read_handle;
+#endif
+}
+
+// returns -1 on error (sets errno) or 0 on success
+static int event_create_wakeup(EventLoop *loop) {
+#ifdef __linux__
+	loop->wakeup_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return loop->wakeup_eventfd < 0 ? -1 : 0;
+#else
+	return pipe_create(&loop->wakeup_pipe, PIPE_FLAG_NON_BLOCKING_READ);
+#endif
+}
+
+static void event_destroy_wakeup(EventLoop *loop) {
+#ifdef __linux__
+	robust_close(loop->wakeup_eventfd);
+#else
+	pipe_destroy(&loop->wakeup_pipe);
+#endif
+}
+
+// might be called from a thread that doesn't run the event loop
+static void event_wakeup(EventLoop *loop) {
+#ifdef __linux__
+	uint64_t value = 1;
+	int rc = robust_write(loop->wakeup_eventfd, &value, sizeof(value));
+#else
+	uint8_t byte = 0;
+	int rc = pipe_write(&loop->wakeup_pipe, &byte, sizeof(byte));
+#endif
+
+	if (rc < 0) {
+		log_error("Could not wake up event loop: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void event_handle_wakeup(void *opaque) {
+	EventLoop *loop = opaque;
+#ifdef __linux__
+	uint64_t value;
+	int rc = robust_read(loop->wakeup_eventfd, &value, sizeof(value));
+#else
+	uint8_t bytes[64];
+	int rc = pipe_read(&loop->wakeup_pipe, bytes, sizeof(bytes));
+#endif
+	EventTask *task;
+	EventTask *next;
+	EventTask *reversed = NULL;
+
+	if (rc < 0 && !errno_would_block()) {
+		log_error("Could not read from wakeup handle: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	if (loop->stop_requested) {
+		loop->running = false;
+
+		return;
+	}
+
+	// take all posted tasks at once. this has to be done after reading from
+	// the wakeup handle, otherwise a wakeup for a task that is posted after
+	// the tasks were taken could be lost
+	task = __sync_lock_test_and_set(&loop->posted_tasks, NULL);
+
+	// the posted tasks are stored in reverse order
+	while (task != NULL) {
+		next = task->next;
+		task->next = reversed;
+		reversed = task;
+		task = next;
+	}
+
+	while (reversed != NULL) {
+		task = reversed;
+		reversed = task->next;
+
+		task->function(task->opaque);
+
+		free(task);
+	}
+}
+
+int event_loop_create(EventLoop *loop) {
 	int phase = 0;
 
-	log_debug("Initializing event subsystem");
+	loop->running = false;
+	loop->stop_requested = false;
+	loop->posted_tasks = NULL;
+	loop->platform = NULL;
 
-	_running = false;
-	_stop_requested = false;
+	node_reset(&loop->pending_sentinel);
+	node_reset(&loop->flush_sentinel);
+	timer_wheel_create(&loop->timer_wheel, millitime());
 
-	// create event source array, the EventSource struct is not relocatable
-	// because epoll might store a pointer to it
-	if (array_create(&_event_sources, 32, sizeof(EventSource), false) < 0) {
-		log_error("Could not create event source array: %s (%d)",
+	// create event source slab. the EventSource structs are not relocatable,
+	// because the platform might store pointers to them. allocating them from
+	// a slab keeps them cache line aligned and close to each other in memory
+	if (slab_create(&loop->source_slab, sizeof(EventSource), 64) < 0) {
+		log_error("Could not create event source slab: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		goto cleanup;
 	}
 
+	// the cold parts of the event sources are kept in a separate slab, so
+	// they don't take up space in the cache lines of the hot parts
+	if (slab_create(&loop->source_cold_slab, sizeof(EventSourceCold), 64) < 0) {
+		log_error("Could not create event source cold slab: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		slab_destroy(&loop->source_slab);
+
+		goto cleanup;
+	}
+
 	phase = 1;
 
-	if (event_init_platform() < 0) {
+	// create event source array
+	if (array_create(&loop->sources, 32, sizeof(EventSource *), true) < 0) {
+		log_error("Could not create event source array: %s (%d)",
+		          get_errno_name(errno), errno);
+
 		goto cleanup;
 	}
 
 	phase = 2;
 
-	// create stop pipe
-	if (pipe_create(&_stop_pipe, PIPE_FLAG_NON_BLOCKING_READ) < 0) {
-		log_error("Could not create stop pipe: %s (%d)",
+	// create event source index, to avoid a linear search over the event
+	// source array on every add, modify and remove operation
+	if (hash_table_create(&loop->source_index, 32) < 0) {
+		log_error("Could not create event source index: %s (%d)",
 		          get_errno_name(errno), errno);
 
 		goto cleanup;
@@ -89,77 +328,220 @@ int event_init(void) {
 
 	phase = 3;
 
-	if (event_add_source(_stop_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                     "event-stop", EVENT_READ, NULL, NULL) < 0) {
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	memset(&loop->statistics, 0, sizeof(loop->statistics));
+
+	// create event source statistics array, the EventSourceStatistics struct
+	// is not relocatable because event sources store a pointer to it
+	if (array_create(&loop->source_statistics, 32, sizeof(EventSourceStatistics), false) < 0) {
+		log_error("Could not create event source statistics array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+#endif
+
+	if (event_init_platform(loop) < 0) {
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+		array_destroy(&loop->source_statistics, NULL);
+#endif
+
 		goto cleanup;
 	}
 
 	phase = 4;
 
+	// create wakeup handle, used to wake up the event loop from other threads
+	// for posted tasks and stop requests
+	if (event_create_wakeup(loop) < 0) {
+		log_error("Could not create wakeup handle: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	if (event_loop_add_source(loop, event_get_wakeup_handle(loop),
+	                          EVENT_SOURCE_TYPE_GENERIC, "event-wakeup", EVENT_READ,
+	                          event_handle_wakeup, loop) < 0) {
+		goto cleanup;
+	}
+
+	phase = 6;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		event_destroy_wakeup(loop);
+		// fall through
+
+	case 4:
+		event_exit_platform(loop);
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+		array_destroy(&loop->source_statistics, NULL);
+#endif
+		// fall through
+
 	case 3:
-		pipe_destroy(&_stop_pipe);
+		hash_table_destroy(&loop->source_index, NULL);
 		// fall through
 
 	case 2:
-		event_exit_platform();
+		array_destroy(&loop->sources, NULL);
 		// fall through
 
 	case 1:
-		array_destroy(&_event_sources, NULL);
+		slab_destroy(&loop->source_cold_slab);
+		slab_destroy(&loop->source_slab);
 		// fall through
 
 	default:
 		break;
 	}
 
-	return phase == 4 ? 0 : -1;
+	return phase == 6 ? 0 : -1;
 }
 
-void event_exit(void) {
+void event_loop_destroy(EventLoop *loop) {
 	int i;
 	EventSource *event_source;
+	EventTask *task;
 
-	log_debug("Shutting down event subsystem");
+	event_loop_remove_source(loop, event_get_wakeup_handle(loop), EVENT_SOURCE_TYPE_GENERIC);
+	event_destroy_wakeup(loop);
 
-	event_remove_source(_stop_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
-	pipe_destroy(&_stop_pipe);
+	if (loop->timer_wheel.count > 0) {
+		log_warn("Leaking %d scheduled timer(s)", loop->timer_wheel.count);
+	}
+
+	while (loop->posted_tasks != NULL) {
+		task = loop->posted_tasks;
+		loop->posted_tasks = task->next;
 
-	event_exit_platform();
+		log_warn("Dropping task posted to event loop, but never handled");
 
-	event_cleanup_sources();
+		free(task);
+	}
 
-	for (i = 0; i < _event_sources.count; ++i) {
-		event_source = array_get(&_event_sources, i);
+	event_exit_platform(loop);
+
+	event_loop_cleanup_sources(loop);
+
+	for (i = 0; i < loop->sources.count; ++i) {
+		event_source = *(EventSource **)array_get(&loop->sources, i);
 
 		log_warn("Leaking %s event source (handle: %d, name: %s, events: 0x%04X) at index %d",
-		         event_get_source_type_name(event_source->type, false),
-		         event_source->handle, event_source->name, event_source->events, i);
+		         event_get_source_type_name(event_source->cold->type, false),
+		         event_source->cold->handle, event_source->cold->name, event_source->events, i);
 	}
 
-	array_destroy(&_event_sources, NULL);
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	array_destroy(&loop->source_statistics, NULL);
+#endif
+
+	hash_table_destroy(&loop->source_index, NULL);
+	array_destroy(&loop->sources, NULL);
+	slab_destroy(&loop->source_cold_slab);
+	slab_destroy(&loop->source_slab);
+}
+
+static uint64_t event_get_source_key(IOHandle handle, EventSourceType type) {
+	return ((uint64_t)handle << 8) | (uint8_t)type;
+}
+
+static EventSource *event_find_source(EventLoop *loop, IOHandle handle,
+                                      EventSourceType type) {
+	return hash_table_get(&loop->source_index, event_get_source_key(handle, type));
 }
 
-static EventSource *event_find_source(int start, int end, IOHandle handle,
-                                      EventSourceType type, int *index) {
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+
+// returns the statistics shared by all event sources with the same name and
+// type, or NULL if they could not be created. adding event sources is rare
+// compared to handling them, so a linear search is good enough here. names
+// longer than EVENT_STATISTICS_MAX_NAME_LENGTH - 1 are truncated
+static EventSourceStatistics *event_get_source_statistics(EventLoop *loop, const char *name,
+                                                          EventSourceType type) {
 	int i;
-	int step = start < end ? 1 : -1;
-	EventSource *event_source;
+	EventSourceStatistics *statistics;
 
-	for (i = start; i != end; i += step) {
-		event_source = array_get(&_event_sources, i);
+	if (name == NULL) {
+		name = "<unknown>";
+	}
 
-		if (event_source->handle == handle && event_source->type == type) {
-			if (index != NULL) {
-				*index = i;
-			}
+	for (i = 0; i < loop->source_statistics.count; ++i) {
+		statistics = array_get(&loop->source_statistics, i);
 
-			return event_source;
+		if (statistics->type == type && strcmp(statistics->name, name) == 0) {
+			return statistics;
 		}
 	}
 
-	return NULL;
+	statistics = array_append(&loop->source_statistics);
+
+	if (statistics == NULL) {
+		log_warn("Could not append to event source statistics array: %s (%d)",
+		         get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	memset(statistics, 0, sizeof(EventSourceStatistics));
+
+	// copy the name, because it might not outlive the event source
+	string_copy(statistics->name, sizeof(statistics->name), name, -1);
+
+	statistics->type = type;
+
+	return statistics;
+}
+
+#endif
+
+static const uint32_t _handler_events[EVENT_HANDLER_COUNT] = {
+	EVENT_READ, EVENT_WRITE, EVENT_PRIO, EVENT_ERROR
+};
+
+// the read and write handlers are stored in the EventSource, the prio and
+// error handlers in its EventSourceCold
+static EventHandler *event_get_handler(EventSource *event_source, int index) {
+	if (index < EVENT_HANDLER_PRIO) {
+		return &event_source->handlers[index];
+	}
+
+	return &event_source->cold->handlers[index - EVENT_HANDLER_PRIO];
+}
+
+// set FUNCTION and OPAQUE as handler for EVENTS and precompute how the events
+// are dispatched, instead of comparing the handlers on every dispatch
+static void event_set_handlers(EventSource *event_source, uint32_t events,
+                               EventFunction function, void *opaque) {
+	EventHandler *read = event_get_handler(event_source, EVENT_HANDLER_READ);
+	EventHandler *write = event_get_handler(event_source, EVENT_HANDLER_WRITE);
+	EventHandler *prio = event_get_handler(event_source, EVENT_HANDLER_PRIO);
+	EventHandler *error = event_get_handler(event_source, EVENT_HANDLER_ERROR);
+	EventHandler *handler;
+	int i;
+
+	for (i = 0; i < EVENT_HANDLER_COUNT; ++i) {
+		if ((events & _handler_events[i]) != 0) {
+			handler = event_get_handler(event_source, i);
+			handler->function = function;
+			handler->opaque = opaque;
+		}
+	}
+
+	if (prio->function != NULL && prio->function == error->function &&
+	    prio->opaque == error->opaque) {
+		event_source->dispatch_mode = EVENT_DISPATCH_MODE_SHARED_PRIO_ERROR;
+	} else if (read->function != NULL && read->function == write->function &&
+	           read->opaque == write->opaque) {
+		event_source->dispatch_mode = EVENT_DISPATCH_MODE_SHARED_READ_WRITE;
+	} else {
+		event_source->dispatch_mode = EVENT_DISPATCH_MODE_SEPARATE;
+	}
 }
 
 // the event sources array contains tuples (handle, type). each tuple can be
@@ -167,120 +549,140 @@ static EventSource *event_find_source(int start, int end, IOHandle handle,
 // tuple is already in the array is an error. there is one exception from this
 // rule: if a tuple got marked as removed, it is allowed to re-add it even
 // before event_cleanup_sources was called to really remove the tuples that
-// got marked as removed before
-int event_add_source(IOHandle handle, EventSourceType type, const char *name,
-                     uint32_t events, EventFunction function, void *opaque) {
-	int index;
+// got marked as removed before. in this case the removed tuple is reused for
+// the re-added one. therefore, the event source index can map each tuple to
+// exactly one item of the event sources array
+int event_loop_add_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                          const char *name, uint32_t events,
+                          EventFunction function, void *opaque) {
 	EventSource *event_source;
+	EventSource **slot;
 	EventSource backup;
+	EventSourceCold cold_backup;
 
-	event_source = event_find_source(0, _event_sources.count, handle, type, &index);
+	event_source = event_find_source(loop, handle, type);
 
 	if (event_source != NULL) {
 		// readd removed event source
 		if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
 			memcpy(&backup, event_source, sizeof(backup));
+			memcpy(&cold_backup, event_source->cold, sizeof(cold_backup));
 
-			event_source->name = name;
+			event_source->cold->name = name;
 			event_source->events = events;
 			event_source->state = EVENT_SOURCE_STATE_READDED;
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+			event_source->cold->statistics = event_get_source_statistics(loop, name, type);
+#endif
 
-			if ((events & EVENT_READ) != 0) {
-				event_source->read = function;
-				event_source->read_opaque = opaque;
-			}
+			event_set_handlers(event_source, events, function, opaque);
 
-			if ((events & EVENT_WRITE) != 0) {
-				event_source->write = function;
-				event_source->write_opaque = opaque;
-			}
-
-			if ((events & EVENT_PRIO) != 0) {
-				event_source->prio = function;
-				event_source->prio_opaque = opaque;
-			}
-
-			if ((events & EVENT_ERROR) != 0) {
-				event_source->error = function;
-				event_source->error_opaque = opaque;
-			}
-
-			if (event_source_added_platform(event_source) < 0) {
+			if (event_source_added_platform(loop, event_source) < 0) {
 				memcpy(event_source, &backup, sizeof(backup));
+				memcpy(event_source->cold, &cold_backup, sizeof(cold_backup));
 
 				return -1;
 			}
 
-			log_event_debug("Readded %s event source (handle: %d, name: %s) at index %d",
-			                event_get_source_type_name(type, false), handle, name, index);
+			log_event_debug("Readded %s event source (handle: %d, name: %s)",
+			                event_get_source_type_name(type, false), handle, name);
 
 			return 0;
 		}
 
-		log_error("%s event source (handle: %d, name: %s) already added at index %d",
-		          event_get_source_type_name(event_source->type, true),
-		          event_source->handle, event_source->name, index);
+		log_error("%s event source (handle: %d, name: %s) already added",
+		          event_get_source_type_name(event_source->cold->type, true),
+		          event_source->cold->handle, event_source->cold->name);
 
 		return -1;
 	} else {
 		// add new event source
-		event_source = array_append(&_event_sources);
+		slot = array_append(&loop->sources);
 
-		if (event_source == NULL) {
+		if (slot == NULL) {
 			log_error("Could not append to event source array: %s (%d)",
 			          get_errno_name(errno), errno);
 
 			return -1;
 		}
 
-		event_source->handle = handle;
-		event_source->type = type;
-		event_source->name = name;
-		event_source->events = events;
-		event_source->state = EVENT_SOURCE_STATE_ADDED;
+		event_source = slab_alloc(&loop->source_slab);
 
-		if ((events & EVENT_READ) != 0) {
-			event_source->read = function;
-			event_source->read_opaque = opaque;
-		}
+		if (event_source == NULL) {
+			log_error("Could not allocate event source: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			array_remove(&loop->sources, loop->sources.count - 1, NULL);
 
-		if ((events & EVENT_WRITE) != 0) {
-			event_source->write = function;
-			event_source->write_opaque = opaque;
+			return -1;
 		}
 
-		if ((events & EVENT_PRIO) != 0) {
-			event_source->prio = function;
-			event_source->prio_opaque = opaque;
+		event_source->cold = slab_alloc(&loop->source_cold_slab);
+
+		if (event_source->cold == NULL) {
+			log_error("Could not allocate event source: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			array_remove(&loop->sources, loop->sources.count - 1, NULL);
+			slab_free(&loop->source_slab, event_source);
+
+			return -1;
 		}
 
-		if ((events & EVENT_ERROR) != 0) {
-			event_source->error = function;
-			event_source->error_opaque = opaque;
+		*slot = event_source;
+
+		event_source->cold->handle = handle;
+		event_source->cold->type = type;
+		event_source->cold->name = name;
+		event_source->events = events;
+		event_source->state = EVENT_SOURCE_STATE_ADDED;
+		event_source->pending_events = 0;
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+		event_source->cold->statistics = event_get_source_statistics(loop, name, type);
+#endif
+
+		node_reset(&event_source->pending_node);
+
+		event_set_handlers(event_source, events, function, opaque);
+
+		if (hash_table_insert(&loop->source_index,
+		                      event_get_source_key(handle, type), event_source) < 0) {
+			log_error("Could not insert into event source index: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			array_remove(&loop->sources, loop->sources.count - 1, NULL);
+			slab_free(&loop->source_cold_slab, event_source->cold);
+			slab_free(&loop->source_slab, event_source);
+
+			return -1;
 		}
 
-		if (event_source_added_platform(event_source) < 0) {
-			array_remove(&_event_sources, _event_sources.count - 1, NULL);
+		if (event_source_added_platform(loop, event_source) < 0) {
+			hash_table_remove(&loop->source_index, event_get_source_key(handle, type));
+			array_remove(&loop->sources, loop->sources.count - 1, NULL);
+			slab_free(&loop->source_cold_slab, event_source->cold);
+			slab_free(&loop->source_slab, event_source);
 
 			return -1;
 		}
 
 		log_event_debug("Added %s event source (handle: %d, name: %s, events: 0x%04X) at index %d",
 		                event_get_source_type_name(type, false),
-		                handle, name, events, _event_sources.count - 1);
+		                handle, name, events, loop->sources.count - 1);
 
 		return 0;
 	}
 }
 
 // the events that an event source was added for can be modified
-int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
-                        uint32_t events_to_add, EventFunction function, void *opaque) {
-	int index;
+int event_loop_modify_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                             uint32_t events_to_remove, uint32_t events_to_add,
+                             EventFunction function, void *opaque) {
 	EventSource *event_source;
 	EventSource backup;
+	EventSourceCold cold_backup;
 
-	event_source = event_find_source(0, _event_sources.count, handle, type, &index);
+	event_source = event_find_source(loop, handle, type);
 
 	if (event_source == NULL) {
 		log_warn("Could not modify unknown %s event source (handle: %d)",
@@ -290,86 +692,52 @@ int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_t
 	}
 
 	if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
-		log_error("Cannot modify removed %s event source (handle: %d, name: %s) at index %d",
-		          event_get_source_type_name(type, false), event_source->handle,
-		          event_source->name, index);
+		log_error("Cannot modify removed %s event source (handle: %d, name: %s)",
+		          event_get_source_type_name(type, false), event_source->cold->handle,
+		          event_source->cold->name);
 
 		return -1;
 	}
 
 	memcpy(&backup, event_source, sizeof(backup));
+	memcpy(&cold_backup, event_source->cold, sizeof(cold_backup));
 
 	// modify events bitmask
 	if ((event_source->events & events_to_remove) != events_to_remove) {
-		log_warn("Events to be removed (0x%04X) from %s event source (handle: %d, name: %s) at index %d were not added before",
+		log_warn("Events to be removed (0x%04X) from %s event source (handle: %d, name: %s) were not added before",
 		         events_to_remove, event_get_source_type_name(type, false),
-		         event_source->handle, event_source->name, index);
+		         event_source->cold->handle, event_source->cold->name);
 	}
 
 	event_source->events &= ~events_to_remove;
 
 	if ((event_source->events & events_to_add) != 0) {
-		log_warn("Events to be added (0x%04X) to %s event source (handle: %d, name: %s) at index %d are already added",
+		log_warn("Events to be added (0x%04X) to %s event source (handle: %d, name: %s) are already added",
 		         events_to_add, event_get_source_type_name(type, false),
-		         event_source->handle, event_source->name, index);
+		         event_source->cold->handle, event_source->cold->name);
 	}
 
 	event_source->events |= events_to_add;
 
 	// unset functions for removed events
-	if ((events_to_remove & EVENT_READ) != 0) {
-		event_source->read = NULL;
-		event_source->read_opaque = NULL;
-	}
-
-	if ((events_to_remove & EVENT_WRITE) != 0) {
-		event_source->write = NULL;
-		event_source->write_opaque = NULL;
-	}
-
-	if ((events_to_remove & EVENT_PRIO) != 0) {
-		event_source->prio = NULL;
-		event_source->prio_opaque = NULL;
-	}
-
-	if ((events_to_remove & EVENT_ERROR) != 0) {
-		event_source->error = NULL;
-		event_source->error_opaque = NULL;
-	}
+	event_set_handlers(event_source, events_to_remove, NULL, NULL);
 
 	// set functions for added events
-	if ((events_to_add & EVENT_READ) != 0) {
-		event_source->read = function;
-		event_source->read_opaque = opaque;
-	}
-
-	if ((events_to_add & EVENT_WRITE) != 0) {
-		event_source->write = function;
-		event_source->write_opaque = opaque;
-	}
-
-	if ((events_to_add & EVENT_PRIO) != 0) {
-		event_source->prio = function;
-		event_source->prio_opaque = opaque;
-	}
-
-	if ((events_to_add & EVENT_ERROR) != 0) {
-		event_source->error = function;
-		event_source->error_opaque = opaque;
-	}
+	event_set_handlers(event_source, events_to_add, function, opaque);
 
 	event_source->state = EVENT_SOURCE_STATE_MODIFIED;
 
-	if (event_source_modified_platform(event_source) < 0) {
+	if (event_source_modified_platform(loop, event_source) < 0) {
 		memcpy(event_source, &backup, sizeof(backup));
+		memcpy(event_source->cold, &cold_backup, sizeof(cold_backup));
 
 		return -1;
 	}
 
-	log_event_debug("Modified (removed: 0x%04X, added: 0x%04X) %s event source (handle: %d, name: %s) at index %d",
+	log_event_debug("Modified (removed: 0x%04X, added: 0x%04X) %s event source (handle: %d, name: %s)",
 	                events_to_remove, events_to_add,
-	                event_get_source_type_name(type, false), event_source->handle,
-	                event_source->name, index);
+	                event_get_source_type_name(type, false), event_source->cold->handle,
+	                event_source->cold->name);
 
 	return 0;
 }
@@ -377,14 +745,14 @@ int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_t
 // only mark event sources as removed here, because the event loop might
 // be in the middle of iterating the event sources array when this function
 // is called
-void event_remove_source(IOHandle handle, EventSourceType type) {
-	int index;
+void event_loop_remove_source(EventLoop *loop, IOHandle handle, EventSourceType type) {
 	EventSource *event_source;
 
-	// iterate backwards to remove the last added instance of an event source,
-	// otherwise an remove-add-remove sequence for the same event source between
-	// two calls to event_cleanup_sources doesn't work properly
-	event_source = event_find_source(_event_sources.count - 1, -1, handle, type, &index);
+	// the index always refers to the last added instance of an event source,
+	// because a re-added event source reuses the item of its removed instance.
+	// this makes a remove-add-remove sequence for the same event source between
+	// two calls to event_cleanup_sources work properly
+	event_source = event_find_source(loop, handle, type);
 
 	if (event_source == NULL) {
 		log_warn("Could not mark unknown %s event source (handle: %d) as removed",
@@ -394,138 +762,414 @@ void event_remove_source(IOHandle handle, EventSourceType type) {
 	}
 
 	if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
-		log_warn("%s event source (handle: %d, name: %s, events: 0x%04X) already marked as removed at index %d",
-		         event_get_source_type_name(event_source->type, true),
-		         event_source->handle, event_source->name, event_source->events, index);
+		log_warn("%s event source (handle: %d, name: %s, events: 0x%04X) already marked as removed",
+		         event_get_source_type_name(event_source->cold->type, true),
+		         event_source->cold->handle, event_source->cold->name, event_source->events);
 	} else {
 		event_source->state = EVENT_SOURCE_STATE_REMOVED;
 
-		event_source_removed_platform(event_source);
+		if (event_source->pending_events != 0) {
+			event_source->pending_events = 0;
 
-		log_event_debug("Marked %s event source (handle: %d, name: %s, events: 0x%04X) as removed at index %d",
-		                event_get_source_type_name(event_source->type, false),
-		                event_source->handle, event_source->name,
-		                event_source->events, index);
+			node_remove(&event_source->pending_node);
+		}
+
+		event_source_removed_platform(loop, event_source);
+
+		log_event_debug("Marked %s event source (handle: %d, name: %s, events: 0x%04X) as removed",
+		                event_get_source_type_name(event_source->cold->type, false),
+		                event_source->cold->handle, event_source->cold->name,
+		                event_source->events);
+	}
+}
+
+// an event function that stopped early, e.g. because it reached the
+// EVENT_READ_BUDGET of an edge-triggered event source, can request to be
+// called again for EVENTS in the next iteration of the event loop. this
+// doesn't depend on the backend reporting the event source as ready again
+int event_loop_rearm_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                            uint32_t events) {
+	EventSource *event_source = event_find_source(loop, handle, type);
+
+	if (event_source == NULL) {
+		log_warn("Could not rearm unknown %s event source (handle: %d)",
+		         event_get_source_type_name(type, false), handle);
+
+		return -1;
+	}
+
+	if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
+		log_error("Cannot rearm removed %s event source (handle: %d, name: %s)",
+		          event_get_source_type_name(type, false), event_source->cold->handle,
+		          event_source->cold->name);
+
+		return -1;
 	}
+
+	events &= event_source->events & ~(uint32_t)EVENT_EDGE;
+
+	if (events == 0) {
+		return 0;
+	}
+
+	if (event_source->pending_events == 0) {
+		node_insert_before(&loop->pending_sentinel, &event_source->pending_node);
+	}
+
+	event_source->pending_events |= (uint16_t)events;
+
+	log_event_debug("Rearmed %s event source (handle: %d, name: %s, pending-events: 0x%04X)",
+	                event_get_source_type_name(type, false), event_source->cold->handle,
+	                event_source->cold->name, event_source->pending_events);
+
+	return 0;
 }
 
 // remove event sources that got marked as removed and mark (re-)added event
 // sources as normal
-void event_cleanup_sources(void) {
+void event_loop_cleanup_sources(EventLoop *loop) {
 	int i;
 	EventSource *event_source;
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	uint64_t started = microtime();
+#endif
 
 	// iterate backwards for simpler index handling and to be able to print
 	// the correct index
-	for (i = _event_sources.count - 1; i >= 0; --i) {
-		event_source = array_get(&_event_sources, i);
+	for (i = loop->sources.count - 1; i >= 0; --i) {
+		event_source = *(EventSource **)array_get(&loop->sources, i);
 
 		if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
 			log_event_debug("Removed %s event source (handle: %d, name: %s, events: 0x%04X) at index %d",
-			                event_get_source_type_name(event_source->type, false),
-			                event_source->handle, event_source->name,
+			                event_get_source_type_name(event_source->cold->type, false),
+			                event_source->cold->handle, event_source->cold->name,
 			                event_source->events, i);
 
-			array_remove(&_event_sources, i, NULL);
+			hash_table_remove(&loop->source_index,
+			                  event_get_source_key(event_source->cold->handle, event_source->cold->type));
+			array_remove(&loop->sources, i, NULL);
+			slab_free(&loop->source_cold_slab, event_source->cold);
+			slab_free(&loop->source_slab, event_source);
 		} else {
 			event_source->state = EVENT_SOURCE_STATE_NORMAL;
 		}
 	}
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	loop->statistics.cleanup_duration += microtime() - started;
+#endif
 }
 
-void event_handle_source(EventSource *event_source, uint32_t received_events) {
-	if (event_source->state != EVENT_SOURCE_STATE_NORMAL) {
-		log_event_debug("Ignoring %s event source (handle: %d, name: %s, received-events: 0x%04X) in state transition",
-		                event_get_source_type_name(event_source->type, false),
-		                event_source->handle, event_source->name, received_events);
+// handle all event sources that were rearmed before this call. event sources
+// rearmed during this call are handled by the next call. event sources in
+// a state transition are kept pending until event_cleanup_sources was called
+void event_loop_handle_pending_sources(EventLoop *loop) {
+	Node marker;
+	Node *node;
+	EventSource *event_source;
+	uint32_t events;
 
+	if (loop->pending_sentinel.next == &loop->pending_sentinel) {
 		return;
 	}
 
-	log_event_debug("Handling %s event source (handle: %d, name: %s, received-events: 0x%04X)",
-	                event_get_source_type_name(event_source->type, false),
-	                event_source->handle, event_source->name, received_events);
-
-	// Here we currently only check if prio and error or read and write have
-	// the same functions. Currently read/write and prio/error are not mixed.
-	// It is probably OK to leave it this way since they never seem to be used
-	// together. For example: On a sysfs gpio value file you can only use
-	// prio/error, while on an eventfd or similar prio/error can't be used.
-	if (event_source->prio != NULL &&
-	    event_source->prio == event_source->error &&
-	    event_source->prio_opaque == event_source->error_opaque) {
-		// prio and error event function are the same, don't call it twice,
-		// only call the prio event function once
+	node_insert_before(&loop->pending_sentinel, &marker);
+
+	while (loop->running && loop->pending_sentinel.next != &marker) {
+		node = loop->pending_sentinel.next;
+		event_source = containerof(node, EventSource, pending_node);
+
+		node_remove(node);
+
+		if (event_source->state != EVENT_SOURCE_STATE_NORMAL) {
+			node_insert_before(&loop->pending_sentinel, node);
+
+			continue;
+		}
+
+		events = event_source->pending_events;
+		event_source->pending_events = 0;
+
+		event_handle_source(event_source, events);
+	}
+
+	node_remove(&marker);
+}
+
+static void event_call_functions(EventSource *event_source, uint32_t received_events) {
+	EventHandler *handler;
+	int i;
+
+	// the dispatch mode is only shared if the functions and opaques are the
+	// same, don't call the function twice in this case. currently read/write
+	// and prio/error are not mixed. it is probably OK to leave it this way
+	// since they never seem to be used together. for example: on a sysfs gpio
+	// value file you can only use prio/error, while on an eventfd or similar
+	// prio/error can't be used.
+	switch (event_source->dispatch_mode) {
+	case EVENT_DISPATCH_MODE_SHARED_PRIO_ERROR:
 		if ((received_events & (EVENT_PRIO | EVENT_ERROR)) != 0) {
-			event_source->prio(event_source->prio_opaque);
+			handler = event_get_handler(event_source, EVENT_HANDLER_PRIO);
+			handler->function(handler->opaque);
 		}
-	} else if (event_source->read != NULL &&
-	           event_source->read == event_source->write &&
-	           event_source->read_opaque == event_source->write_opaque) {
-		// read and write event function are the same, don't call it twice,
-		// only call the read event function once
+
+		break;
+
+	case EVENT_DISPATCH_MODE_SHARED_READ_WRITE:
 		if ((received_events & (EVENT_READ | EVENT_WRITE)) != 0) {
-			event_source->read(event_source->read_opaque);
-		}
-	} else {
-		if ((received_events & EVENT_READ) != 0 && event_source->read != NULL) {
-			event_source->read(event_source->read_opaque);
+			handler = &event_source->handlers[EVENT_HANDLER_READ];
+			handler->function(handler->opaque);
 		}
 
-		if ((received_events & EVENT_WRITE) != 0 && event_source->write != NULL) {
-			// if the event source got removed in the meantime then don't deliver
-			// the write event anymore
-			if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
-				log_debug("Ignoring removed %s event source (handle: %d, name: %s, received-events: 0x%04X)",
-				          event_get_source_type_name(event_source->type, false),
-				          event_source->handle, event_source->name, received_events);
+		break;
 
-				return;
+	default:
+		for (i = 0; i < EVENT_HANDLER_COUNT; ++i) {
+			// only look at the handler if its event was received, to not touch
+			// the cold part of the event source for read and write events
+			if ((received_events & _handler_events[i]) == 0) {
+				continue;
 			}
 
-			event_source->write(event_source->write_opaque);
-		}
+			handler = event_get_handler(event_source, i);
 
-		if ((received_events & EVENT_PRIO) != 0 && event_source->prio != NULL) {
-			// if the event source got removed in the meantime then don't deliver
-			// the write event anymore
-			if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
+			if (handler->function == NULL) {
+				continue;
+			}
+
+			// if the event source got removed by a previous function then
+			// don't deliver the other events anymore
+			if (i > 0 && event_source->state == EVENT_SOURCE_STATE_REMOVED) {
 				log_debug("Ignoring removed %s event source (handle: %d, name: %s, received-events: 0x%04X)",
-				          event_get_source_type_name(event_source->type, false),
-				          event_source->handle, event_source->name, received_events);
+				          event_get_source_type_name(event_source->cold->type, false),
+				          event_source->cold->handle, event_source->cold->name, received_events);
 
 				return;
 			}
 
-			event_source->prio(event_source->prio_opaque);
+			handler->function(handler->opaque);
 		}
 
-		if ((received_events & EVENT_ERROR) != 0 && event_source->error != NULL) {
-			// if the event source got removed in the meantime then don't deliver
-			// the write event anymore
-			if (event_source->state == EVENT_SOURCE_STATE_REMOVED) {
-				log_debug("Ignoring removed %s event source (handle: %d, name: %s, received-events: 0x%04X)",
-				          event_get_source_type_name(event_source->type, false),
-				          event_source->handle, event_source->name, received_events);
+		break;
+	}
+}
 
-				return;
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+
+static void event_record_dispatch(EventLoop *loop, EventSourceStatistics *statistics,
+                                  uint64_t duration) {
+	int bucket = duration == 0 ? 0 : 64 - __builtin_clzll(duration);
+
+	++loop->statistics.dispatch_count;
+	++loop->statistics.iteration_dispatch_count;
+	loop->statistics.dispatch_duration += duration;
+
+	if (statistics == NULL) {
+		return;
+	}
+
+	if (bucket >= EVENT_STATISTICS_HISTOGRAM_SIZE) {
+		bucket = EVENT_STATISTICS_HISTOGRAM_SIZE - 1;
+	}
+
+	++statistics->dispatch_count;
+	++statistics->histogram[bucket];
+	statistics->total_duration += duration;
+
+	if (duration > statistics->max_duration) {
+		statistics->max_duration = duration;
+	}
+}
+
+#endif
+
+void event_handle_source(EventSource *event_source, uint32_t received_events) {
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	// the event source might be removed by its functions, but the statistics
+	// are kept until the event loop is destroyed
+	EventSourceStatistics *statistics = event_source->cold->statistics;
+	uint64_t started;
+#endif
+
+	if (event_source->state != EVENT_SOURCE_STATE_NORMAL) {
+		log_event_debug("Ignoring %s event source (handle: %d, name: %s, received-events: 0x%04X) in state transition",
+		                event_get_source_type_name(event_source->cold->type, false),
+		                event_source->cold->handle, event_source->cold->name, received_events);
+
+		return;
+	}
+
+	log_event_debug("Handling %s event source (handle: %d, name: %s, received-events: 0x%04X)",
+	                event_get_source_type_name(event_source->cold->type, false),
+	                event_source->cold->handle, event_source->cold->name, received_events);
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	started = microtime();
+#endif
+
+	event_call_functions(event_source, received_events);
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	event_record_dispatch(event_get_current_loop(), statistics, microtime() - started);
+#endif
+}
+
+// returns the maximum time in milliseconds the platform is allowed to block
+// while waiting for events of LOOP, -1 means no limit. if event sources or
+// flushes are pending then the platform should only check for new events without blocking,
+// otherwise it should not block beyond the next timer expiration
+int event_loop_get_timeout(EventLoop *loop) {
+	if (loop->pending_sentinel.next != &loop->pending_sentinel ||
+	    loop->flush_sentinel.next != &loop->flush_sentinel) {
+		return 0;
+	}
+
+	return timer_wheel_get_timeout(&loop->timer_wheel, millitime());
+}
+
+// call the functions of all expired timers of LOOP
+void event_loop_handle_timers(EventLoop *loop) {
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	uint64_t started = microtime();
+#endif
+
+	timer_wheel_advance(&loop->timer_wheel, millitime());
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	loop->statistics.timer_duration += microtime() - started;
+#endif
+}
+
+// call the functions of all flushes of LOOP that were scheduled before this
+// call. flushes scheduled during this call are handled by the next call
+void event_loop_handle_flushes(EventLoop *loop) {
+	Node marker;
+	EventFlush *flush;
+
+	if (loop->flush_sentinel.next == &loop->flush_sentinel) {
+		return;
+	}
+
+	node_insert_before(&loop->flush_sentinel, &marker);
+
+	while (loop->running && loop->flush_sentinel.next != &marker) {
+		flush = containerof(loop->flush_sentinel.next, EventFlush, node);
+
+		node_remove(&flush->node);
+
+		flush->scheduled = false;
+
+		// this call might schedule or cancel any flush
+		flush->function(flush->opaque);
+	}
+
+	node_remove(&marker);
+}
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+
+// called by the platform right before and after waiting for events. the loop
+// statistics count dispatched event sources per iteration instead of events
+// reported by the platform, because not all platforms report them that way
+void event_loop_wait_started(EventLoop *loop) {
+	EventLoopStatistics *statistics = &loop->statistics;
+
+	if (statistics->iteration_dispatch_count > statistics->max_dispatch_count) {
+		statistics->max_dispatch_count = statistics->iteration_dispatch_count;
+	}
+
+	statistics->iteration_dispatch_count = 0;
+	statistics->wait_started = microtime();
+}
+
+void event_loop_wait_finished(EventLoop *loop) {
+	EventLoopStatistics *statistics = &loop->statistics;
+
+	++statistics->iteration_count;
+	statistics->wait_duration += microtime() - statistics->wait_started;
+}
+
+// the statistics of a worker loop are read without synchronization while its
+// thread might update them. this is acceptable for diagnostic output
+void event_loop_dump_statistics(EventLoop *loop, const char *title) {
+	EventLoopStatistics *statistics = &loop->statistics;
+	EventSourceStatistics *source_statistics;
+	int i;
+	int bucket;
+	char histogram[512];
+	char buffer[64];
+
+	log_info("%s: %" PRIu64 " iteration(s), %" PRIu64 " dispatch(es) (max: %d per iteration), waiting: %" PRIu64 " usec, dispatching: %" PRIu64 " usec, timers: %" PRIu64 " usec, cleaning up: %" PRIu64 " usec",
+	         title, statistics->iteration_count, statistics->dispatch_count,
+	         statistics->max_dispatch_count, statistics->wait_duration,
+	         statistics->dispatch_duration, statistics->timer_duration,
+	         statistics->cleanup_duration);
+
+	for (i = 0; i < loop->source_statistics.count; ++i) {
+		source_statistics = array_get(&loop->source_statistics, i);
+		histogram[0] = '\0';
+
+		for (bucket = 0; bucket < EVENT_STATISTICS_HISTOGRAM_SIZE; ++bucket) {
+			if (source_statistics->histogram[bucket] == 0) {
+				continue;
 			}
 
-			event_source->error(event_source->error_opaque);
+			if (bucket == EVENT_STATISTICS_HISTOGRAM_SIZE - 1) {
+				snprintf(buffer, sizeof(buffer), "%s>=%u: %" PRIu64,
+				         histogram[0] != '\0' ? ", " : "", 1u << (bucket - 1),
+				         source_statistics->histogram[bucket]);
+			} else {
+				snprintf(buffer, sizeof(buffer), "%s<%u: %" PRIu64,
+				         histogram[0] != '\0' ? ", " : "", 1u << bucket,
+				         source_statistics->histogram[bucket]);
+			}
+
+			string_append(histogram, sizeof(histogram), buffer);
 		}
+
+		log_info("%s: %s event source (name: %s): %" PRIu64 " dispatch(es), total: %" PRIu64 " usec, max: %" PRIu64 " usec, histogram (usec): [%s]",
+		         title, event_get_source_type_name(source_statistics->type, false),
+		         source_statistics->name, source_statistics->dispatch_count,
+		         source_statistics->total_duration, source_statistics->max_duration,
+		         histogram);
 	}
 }
 
-int event_run(EventCleanupFunction cleanup) {
+void event_dump_statistics(void) {
+	int i;
+	char title[64];
+
+	event_loop_dump_statistics(&_default_loop, "Default event loop");
+
+	for (i = 0; i < _workers.count; ++i) {
+		snprintf(title, sizeof(title), "Event worker loop %d", i + 1);
+
+		event_loop_dump_statistics(&((EventWorker *)array_get(&_workers, i))->loop, title);
+	}
+}
+
+#endif
+
+static void event_handle_worker_cleanup(void) {
+}
+
+static void event_run_worker(void *opaque) {
+	EventWorker *worker = opaque;
+
+	event_loop_run(&worker->loop, event_handle_worker_cleanup);
+}
+
+int event_loop_run(EventLoop *loop, EventCleanupFunction cleanup) {
 	int rc;
+	EventLoop *previous_loop;
 
-	if (_running) {
+	if (loop->running) {
 		log_warn("Event loop already running");
 
 		return 0;
 	}
 
-	if (_stop_requested) {
+	if (loop->stop_requested) {
 		log_debug("Not starting the event loop, stop was requested");
 
 		return 0;
@@ -533,7 +1177,12 @@ int event_run(EventCleanupFunction cleanup) {
 
 	log_debug("Starting the event loop");
 
-	rc = event_run_platform(&_event_sources, &_running, cleanup);
+	previous_loop = _current_loop;
+	_current_loop = loop;
+
+	rc = event_run_platform(loop, cleanup);
+
+	_current_loop = previous_loop;
 
 	if (rc < 0) {
 		log_error("Event loop aborted");
@@ -544,26 +1193,146 @@ int event_run(EventCleanupFunction cleanup) {
 	return rc;
 }
 
-// might be called from a non-main-thread
-void event_stop(void) {
-	uint8_t byte = 0;
+// might be called from a thread that doesn't run the event loop
+void event_loop_stop(EventLoop *loop) {
+	if (loop->stop_requested) {
+		return;
+	}
+
+	loop->stop_requested = true;
+	loop->running = false;
+
+	// wake the event loop up to make it recognize the stop request. this is
+	// done even if the event loop is not running yet, because its thread might
+	// just be about to start it
+	event_wakeup(loop);
+
+	log_debug("Stopping the event loop");
+}
+
+// calls FUNCTION with OPAQUE from the thread running LOOP, in the order in
+// which the tasks were posted. this can be called from any thread and is
+// lock-free. all tasks posted before the event loop woke up are handled as
+// one batch, and only the first task of each batch writes to the wakeup
+// handle.
+//
+// returns -1 on error (sets errno) or 0 on success
+int event_loop_post(EventLoop *loop, EventFunction function, void *opaque) {
+	EventTask *task = malloc(sizeof(EventTask));
+	EventTask *head;
+
+	if (task == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
 
-	_stop_requested = true;
+	task->function = function;
+	task->opaque = opaque;
 
-	if (!_running) {
+	do {
+		head = loop->posted_tasks;
+		task->next = head;
+	} while (!__sync_bool_compare_and_swap(&loop->posted_tasks, head, task));
+
+	// the previous tasks of this batch already woke the event loop up
+	if (head == NULL) {
+		event_wakeup(loop);
+	}
+
+	return 0;
+}
+
+void event_flush_create(EventFlush *flush, EventFunction function, void *opaque) {
+	node_reset(&flush->node);
+
+	flush->scheduled = false;
+	flush->function = function;
+	flush->opaque = opaque;
+}
+
+// schedules FLUSH to be called at the end of the current iteration of LOOP.
+// scheduling an already scheduled flush has no effect. this has to be called
+// from the thread running LOOP
+void event_loop_schedule_flush(EventLoop *loop, EventFlush *flush) {
+	if (flush->scheduled) {
 		return;
 	}
 
-	_running = false;
+	node_insert_before(&loop->flush_sentinel, &flush->node);
 
-	// write to the stop pipe to wake the event loop up to make it recognize
-	// the stop request
-	if (pipe_write(&_stop_pipe, &byte, sizeof(byte)) < 0) {
-		log_error("Could not write to stop pipe: %s (%d)",
-		          get_errno_name(errno), errno);
+	flush->scheduled = true;
+}
 
+void event_cancel_flush(EventFlush *flush) {
+	if (!flush->scheduled) {
 		return;
 	}
 
-	log_debug("Stopping the event loop");
+	node_remove(&flush->node);
+
+	flush->scheduled = false;
+}
+
+int event_add_source(IOHandle handle, EventSourceType type, const char *name,
+                     uint32_t events, EventFunction function, void *opaque) {
+	return event_loop_add_source(event_get_current_loop(), handle, type, name,
+	                             events, function, opaque);
+}
+
+int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
+                        uint32_t events_to_add, EventFunction function, void *opaque) {
+	return event_loop_modify_source(event_get_current_loop(), handle, type,
+	                                events_to_remove, events_to_add, function, opaque);
+}
+
+void event_remove_source(IOHandle handle, EventSourceType type) {
+	event_loop_remove_source(event_get_current_loop(), handle, type);
+}
+
+int event_rearm_source(IOHandle handle, EventSourceType type, uint32_t events) {
+	return event_loop_rearm_source(event_get_current_loop(), handle, type, events);
+}
+
+void event_cleanup_sources(void) {
+	event_loop_cleanup_sources(event_get_current_loop());
+}
+
+void event_schedule_flush(EventFlush *flush) {
+	event_loop_schedule_flush(event_get_current_loop(), flush);
+}
+
+// runs the default event loop and all worker loops until event_stop is called
+int event_run(EventCleanupFunction cleanup) {
+	int rc;
+	int i;
+	EventWorker *worker;
+
+	for (i = 0; i < _workers.count; ++i) {
+		worker = array_get(&_workers, i);
+
+		thread_create(&worker->thread, event_run_worker, worker);
+	}
+
+	rc = event_loop_run(&_default_loop, cleanup);
+
+	for (i = 0; i < _workers.count; ++i) {
+		worker = array_get(&_workers, i);
+
+		event_loop_stop(&worker->loop);
+		thread_join(&worker->thread);
+		thread_destroy(&worker->thread);
+	}
+
+	return rc;
+}
+
+// might be called from a non-main-thread
+void event_stop(void) {
+	event_loop_stop(&_default_loop);
+}
+
+// might be called from a non-main-thread, posts to the default event loop
+int event_post(EventFunction function, void *opaque) {
+	return event_loop_post(&_default_loop, function, opaque);
 }
@@ -33,7 +33,13 @@
 	#endif
 #endif
 
+#include "array.h"
+#include "hash_table.h"
 #include "io.h"
+#include "node.h"
+#include "pipe.h"
+#include "slab.h"
+#include "timer_wheel.h"
 
 typedef void (*EventFunction)(void *opaque);
 typedef void (*EventCleanupFunction)(void);
@@ -43,22 +49,33 @@ typedef enum { // bitmask
 	EVENT_READ  = 0x0001,
 	EVENT_WRITE = 0x0004,
 	EVENT_PRIO  = 0x0002,
-	EVENT_ERROR = 0x0008
+	EVENT_ERROR = 0x0008,
+	EVENT_EDGE  = 0x0100
 #else
 	#if defined __linux__ && defined DAEMONLIB_WITH_EPOLL
 		EVENT_READ  = EPOLLIN,
 		EVENT_WRITE = EPOLLOUT,
 		EVENT_PRIO  = EPOLLPRI,
-		EVENT_ERROR = EPOLLERR
+		EVENT_ERROR = EPOLLERR,
+		EVENT_EDGE  = EPOLLET
 	#else
 		EVENT_READ  = POLLIN,
 		EVENT_WRITE = POLLOUT,
 		EVENT_PRIO  = POLLPRI,
-		EVENT_ERROR = POLLERR
+		EVENT_ERROR = POLLERR,
+		EVENT_EDGE  = 0x4000 // not supported by poll, masked out by event_posix.c
 	#endif
 #endif
 } Event;
 
+// an event source added with EVENT_EDGE is only reported again after new data
+// arrived, if the backend supports edge-triggered notification. its event
+// functions should stop after at most EVENT_READ_BUDGET reads or writes to
+// not starve other event sources and call event_rearm_source if there might
+// be more to do. the event functions are then called again in the next
+// iteration of the event loop without waiting for new events
+#define EVENT_READ_BUDGET 16
+
 typedef enum {
 	EVENT_SOURCE_TYPE_GENERIC = 0,
 	EVENT_SOURCE_TYPE_USB
@@ -72,37 +89,194 @@ typedef enum {
 	EVENT_SOURCE_STATE_MODIFIED
 } EventSourceState;
 
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+
+// bucket 0 counts durations below 1 microsecond, bucket N counts durations
+// from 2^(N-1) up to 2^N microseconds, the last bucket counts all longer ones
+#define EVENT_STATISTICS_HISTOGRAM_SIZE 24
+
+#define EVENT_STATISTICS_MAX_NAME_LENGTH 64
+
+typedef struct {
+	char name[EVENT_STATISTICS_MAX_NAME_LENGTH];
+	EventSourceType type;
+	uint64_t dispatch_count;
+	uint64_t total_duration; // in microseconds
+	uint64_t max_duration; // in microseconds
+	uint64_t histogram[EVENT_STATISTICS_HISTOGRAM_SIZE];
+} EventSourceStatistics;
+
+typedef struct {
+	uint64_t iteration_count;
+	uint64_t dispatch_count;
+	int max_dispatch_count; // per iteration
+	int iteration_dispatch_count;
+	uint64_t wait_started; // in microseconds
+	uint64_t wait_duration; // in microseconds
+	uint64_t dispatch_duration; // in microseconds
+	uint64_t timer_duration; // in microseconds
+	uint64_t cleanup_duration; // in microseconds
+} EventLoopStatistics;
+
+#endif
+
+typedef enum {
+	EVENT_HANDLER_READ = 0,
+	EVENT_HANDLER_WRITE,
+	EVENT_HANDLER_PRIO,
+	EVENT_HANDLER_ERROR,
+	EVENT_HANDLER_COUNT
+} EventHandlerIndex;
+
+typedef enum {
+	EVENT_DISPATCH_MODE_SEPARATE = 0,
+	EVENT_DISPATCH_MODE_SHARED_READ_WRITE, // same function and opaque for read and write
+	EVENT_DISPATCH_MODE_SHARED_PRIO_ERROR // same function and opaque for prio and error
+} EventDispatchMode;
+
+typedef struct {
+	EventFunction function;
+	void *opaque;
+} EventHandler;
+
+// the members of an EventSource that are not needed to dispatch read and
+// write events. they are allocated from a separate slab, so that the
+// EventSource itself fits into a single cache line
 typedef struct {
 	IOHandle handle;
 	EventSourceType type;
 	const char *name;
+	EventHandler handlers[EVENT_HANDLER_COUNT - EVENT_HANDLER_PRIO]; // EVENT_HANDLER_PRIO and EVENT_HANDLER_ERROR
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	EventSourceStatistics *statistics; // shared by all event sources with same name and type
+#endif
+#ifdef DAEMONLIB_WITH_IO_URING
+	void *io_uring_poll; // owned by event_io_uring.c
+#endif
+#if !defined _WIN32 && !(defined __linux__ && defined DAEMONLIB_WITH_EPOLL)
+	int pollfd_index; // owned by event_posix.c
+#endif
+} EventSourceCold;
+
+// the backends hand a pointer to this struct to event_handle_source. it only
+// contains what is needed to dispatch events and to handle pending event
+// sources, everything else is behind the COLD pointer
+typedef struct {
+	uint8_t state; // EventSourceState
+	uint8_t dispatch_mode; // EventDispatchMode
+	uint16_t pending_events; // != 0 if linked into the pending list of its loop
 	uint32_t events;
-	EventSourceState state;
-	EventFunction read;
-	void *read_opaque;
-	EventFunction write;
-	void *write_opaque;
-	EventFunction prio;
-	void *prio_opaque;
-	EventFunction error;
-	void *error_opaque;
+	EventHandler handlers[EVENT_HANDLER_PRIO]; // EVENT_HANDLER_READ and EVENT_HANDLER_WRITE
+	Node pending_node;
+	EventSourceCold *cold;
 } EventSource;
 
+// an EventFlush is called once at the end of the event loop iteration in
+// which it was scheduled, after all ready and pending event sources and all
+// expired timers were handled. this allows to collect work from several event
+// functions and to do it at once, e.g. writing buffered data to a socket
+typedef struct {
+	Node node;
+	bool scheduled;
+	EventFunction function;
+	void *opaque;
+} EventFlush;
+
+#define EVENT_LOOP_ROUND_ROBIN (-1)
+
+typedef struct _EventTask EventTask;
+
+typedef struct {
+	bool running;
+	bool stop_requested;
+	Slab source_slab; // EventSource
+	Slab source_cold_slab; // EventSourceCold
+	Array sources; // EventSource *
+	HashTable source_index; // (handle, type) -> EventSource
+	Node pending_sentinel; // EventSource.pending_node, see event_rearm_source
+	Node flush_sentinel; // EventFlush.node, see event_schedule_flush
+	EventTask *posted_tasks; // LIFO, see event_loop_post
+	TimerWheel timer_wheel; // see timer_event.c
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+	Array source_statistics; // EventSourceStatistics, not relocatable
+	EventLoopStatistics statistics;
+#endif
+#ifdef __linux__
+	IOHandle wakeup_eventfd;
+#else
+	Pipe wakeup_pipe;
+#endif
+	void *platform; // owned by the event_*_platform functions
+} EventLoop;
+
 const char *event_get_source_type_name(EventSourceType type, bool upper);
 
 int event_init(void);
 void event_exit(void);
 
+int event_create_worker_loops(int count);
+
+EventLoop *event_get_default_loop(void);
+EventLoop *event_get_current_loop(void);
+EventLoop *event_get_loop(int hint);
+
+int event_loop_create(EventLoop *loop);
+void event_loop_destroy(EventLoop *loop);
+
+int event_loop_add_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                          const char *name, uint32_t events,
+                          EventFunction function, void *opaque);
+int event_loop_modify_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                             uint32_t events_to_remove, uint32_t events_to_add,
+                             EventFunction function, void *opaque);
+void event_loop_remove_source(EventLoop *loop, IOHandle handle, EventSourceType type);
+int event_loop_rearm_source(EventLoop *loop, IOHandle handle, EventSourceType type,
+                            uint32_t events);
+void event_loop_cleanup_sources(EventLoop *loop);
+void event_loop_handle_pending_sources(EventLoop *loop);
+void event_loop_handle_timers(EventLoop *loop);
+void event_loop_handle_flushes(EventLoop *loop);
+
+int event_loop_run(EventLoop *loop, EventCleanupFunction cleanup);
+void event_loop_stop(EventLoop *loop);
+
+int event_loop_post(EventLoop *loop, EventFunction function, void *opaque);
+
+void event_flush_create(EventFlush *flush, EventFunction function, void *opaque);
+void event_loop_schedule_flush(EventLoop *loop, EventFlush *flush);
+void event_cancel_flush(EventFlush *flush);
+
 int event_add_source(IOHandle handle, EventSourceType type, const char *name,
                      uint32_t events, EventFunction function, void *opaque);
 int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
                         uint32_t events_to_add, EventFunction function, void *opaque);
 void event_remove_source(IOHandle handle, EventSourceType type);
+int event_rearm_source(IOHandle handle, EventSourceType type, uint32_t events);
 void event_cleanup_sources(void);
 
 void event_handle_source(EventSource *event_source, uint32_t received_events);
+int event_loop_get_timeout(EventLoop *loop);
 
 int event_run(EventCleanupFunction cleanup);
 void event_stop(void);
 
+int event_post(EventFunction function, void *opaque);
+
+void event_schedule_flush(EventFlush *flush);
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+
+void event_loop_wait_started(EventLoop *loop);
+void event_loop_wait_finished(EventLoop *loop);
+
+void event_loop_dump_statistics(EventLoop *loop, const char *title);
+void event_dump_statistics(void);
+
+#else
+
+#define event_loop_wait_started(loop) ((void)(loop))
+#define event_loop_wait_finished(loop) ((void)(loop))
+
+#endif
+
 #endif // DAEMONLIB_EVENT_H
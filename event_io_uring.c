@@ -0,0 +1,556 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_io_uring.c: io_uring based event loop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * each event source is watched by a level-triggered multishot poll request.
+ * adding, modifying and removing an event source only queues a submission
+ * queue entry. all queued entries are submitted together with the wait for
+ * the next completion, so toggling EVENT_WRITE doesn't cost a syscall anymore.
+ *
+ * in contrast to epoll_ctl(EPOLL_CTL_DEL) removing a poll request is not
+ * synchronous. there might still be completions for a removed event source
+ * in the completion queue after the EventSource struct got freed. therefore,
+ * the user data of a poll request doesn't point to the EventSource directly,
+ * but to an IOUringPoll struct that is detached from the EventSource on
+ * removal and freed after the final completion of its poll request arrived.
+ *
+ * this requires Linux 6.0 for level-triggered multishot poll. if the kernel
+ * refuses to set up such a poll request then the epoll based implementation
+ * from event_linux.c is used instead. therefore, event_linux.c has to be
+ * compiled with DAEMONLIB_WITH_IO_URING defined as well.
+ */
+
+#include <errno.h>
+#include <liburing.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "event.h"
+
+#include "array.h"
+#include "log.h"
+#include "node.h"
+#include "utils.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define RING_ENTRIES 256
+
+typedef struct {
+	struct io_uring ring;
+	Node poll_sentinel;
+	int poll_count;
+} IOUring;
+
+typedef struct {
+	Node node;
+	IOUring *io_uring;
+	EventSource *event_source; // NULL if detached from its event source
+	bool armed;
+	bool edge; // armed without IORING_POLL_ADD_LEVEL
+} IOUringPoll;
+
+extern int event_init_epoll(EventLoop *loop);
+extern void event_exit_epoll(EventLoop *loop);
+extern int event_source_added_epoll(EventLoop *loop, EventSource *event_source);
+extern int event_source_modified_epoll(EventLoop *loop, EventSource *event_source);
+extern void event_source_removed_epoll(EventLoop *loop, EventSource *event_source);
+extern int event_run_epoll(EventLoop *loop, EventCleanupFunction cleanup);
+
+void event_source_removed_platform(EventLoop *loop, EventSource *event_source);
+
+// the kernel support is probed once for all event loops
+static bool _probed = false;
+static bool _use_epoll = false;
+
+// sets errno on error
+static int event_probe_io_uring(void) {
+	struct io_uring ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int handle;
+	int rc;
+
+	rc = io_uring_queue_init(4, &ring, 0);
+
+	if (rc < 0) {
+		errno = -rc;
+
+		return -1;
+	}
+
+	// use an eventfd that is readable from the start, the poll request will
+	// complete right away. if the kernel accepts the request and keeps it
+	// armed then it supports level-triggered multishot poll
+	handle = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (handle < 0) {
+		io_uring_queue_exit(&ring);
+
+		return -1;
+	}
+
+	sqe = io_uring_get_sqe(&ring);
+
+	io_uring_prep_poll_multishot(sqe, handle, POLLIN);
+
+	sqe->len |= IORING_POLL_ADD_LEVEL;
+
+	io_uring_sqe_set_data(sqe, &ring);
+
+	rc = io_uring_submit_and_wait(&ring, 1);
+
+	if (rc >= 0) {
+		rc = io_uring_wait_cqe(&ring, &cqe);
+	}
+
+	if (rc >= 0) {
+		if (cqe->res < 0) {
+			rc = cqe->res;
+		} else if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+			rc = -EOPNOTSUPP;
+		}
+	}
+
+	// exiting the ring cancels the probe poll request
+	io_uring_queue_exit(&ring);
+	robust_close(handle);
+
+	if (rc < 0) {
+		errno = -rc;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// returns NULL on error (sets errno) or a submission queue entry on success
+static struct io_uring_sqe *event_get_sqe(IOUring *io_uring) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&io_uring->ring);
+	int rc;
+
+	if (sqe != NULL) {
+		return sqe;
+	}
+
+	// the submission queue is full, submit the queued entries to make room
+	rc = io_uring_submit(&io_uring->ring);
+
+	if (rc < 0) {
+		errno = -rc;
+
+		return NULL;
+	}
+
+	sqe = io_uring_get_sqe(&io_uring->ring);
+
+	if (sqe == NULL) {
+		errno = EBUSY;
+	}
+
+	return sqe;
+}
+
+static int event_arm_poll(IOUringPoll *poll) {
+	EventSource *event_source = poll->event_source;
+	struct io_uring_sqe *sqe = event_get_sqe(poll->io_uring);
+
+	if (sqe == NULL) {
+		log_error("Could not arm poll request for %s event source (handle: %d): %s (%d)",
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// a multishot poll request is edge-triggered, unless it is explicitly
+	// requested to be level-triggered
+	poll->edge = (event_source->events & EVENT_EDGE) != 0;
+
+	io_uring_prep_poll_multishot(sqe, event_source->cold->handle,
+	                             event_source->events & ~EVENT_EDGE);
+
+	if (!poll->edge) {
+		sqe->len |= IORING_POLL_ADD_LEVEL;
+	}
+
+	io_uring_sqe_set_data(sqe, poll);
+
+	poll->armed = true;
+
+	return 0;
+}
+
+int event_init_platform(EventLoop *loop) {
+	IOUring *io_uring;
+	int rc;
+
+	if (!_probed) {
+		_probed = true;
+
+		if (event_probe_io_uring() < 0) {
+			log_warn("Kernel does not support level-triggered multishot poll for io_uring, falling back to epoll: %s (%d)",
+			         get_errno_name(errno), errno);
+
+			_use_epoll = true;
+		}
+	}
+
+	if (_use_epoll) {
+		return event_init_epoll(loop);
+	}
+
+	io_uring = calloc(1, sizeof(IOUring));
+
+	if (io_uring == NULL) {
+		log_error("Could not allocate io_uring state: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	rc = io_uring_queue_init(RING_ENTRIES, &io_uring->ring, 0);
+
+	if (rc < 0) {
+		log_error("Could not create io_uring: %s (%d)",
+		          get_errno_name(-rc), -rc);
+
+		free(io_uring);
+
+		return -1;
+	}
+
+	node_reset(&io_uring->poll_sentinel);
+
+	io_uring->poll_count = 0;
+
+	loop->platform = io_uring;
+
+	return 0;
+}
+
+void event_exit_platform(EventLoop *loop) {
+	IOUring *io_uring = loop->platform;
+	IOUringPoll *poll;
+
+	if (_use_epoll) {
+		event_exit_epoll(loop);
+
+		return;
+	}
+
+	// exiting the ring cancels all remaining poll requests
+	io_uring_queue_exit(&io_uring->ring);
+
+	while (io_uring->poll_sentinel.next != &io_uring->poll_sentinel) {
+		poll = containerof(io_uring->poll_sentinel.next, IOUringPoll, node);
+
+		if (poll->event_source != NULL) {
+			poll->event_source->cold->io_uring_poll = NULL;
+		}
+
+		node_remove(&poll->node);
+		free(poll);
+	}
+
+	free(io_uring);
+
+	loop->platform = NULL;
+}
+
+int event_source_added_platform(EventLoop *loop, EventSource *event_source) {
+	IOUring *io_uring = loop->platform;
+	IOUringPoll *poll;
+
+	if (_use_epoll) {
+		return event_source_added_epoll(loop, event_source);
+	}
+
+	poll = calloc(1, sizeof(IOUringPoll));
+
+	if (poll == NULL) {
+		log_error("Could not allocate poll request for %s event source (handle: %d): %s (%d)",
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+
+	poll->io_uring = io_uring;
+	poll->event_source = event_source;
+
+	if (event_arm_poll(poll) < 0) {
+		free(poll);
+
+		return -1;
+	}
+
+	node_insert_before(&io_uring->poll_sentinel, &poll->node);
+
+	event_source->cold->io_uring_poll = poll;
+
+	++io_uring->poll_count;
+
+	return 0;
+}
+
+int event_source_modified_platform(EventLoop *loop, EventSource *event_source) {
+	IOUringPoll *poll;
+	IOUringPoll *new_poll;
+	struct io_uring_sqe *sqe;
+
+	if (_use_epoll) {
+		return event_source_modified_epoll(loop, event_source);
+	}
+
+	poll = event_source->cold->io_uring_poll;
+
+	// the poll request failed before, try to arm it again with the current
+	// events instead of updating it
+	if (!poll->armed) {
+		return event_arm_poll(poll);
+	}
+
+	// a poll update cannot switch between edge-triggered and level-triggered,
+	// replace the poll request instead. add the new one before removing the
+	// old one, to keep the old one if adding the new one fails
+	if (poll->edge != ((event_source->events & EVENT_EDGE) != 0)) {
+		if (event_source_added_platform(loop, event_source) < 0) {
+			return -1;
+		}
+
+		new_poll = event_source->cold->io_uring_poll;
+		event_source->cold->io_uring_poll = poll;
+
+		event_source_removed_platform(loop, event_source);
+
+		event_source->cold->io_uring_poll = new_poll;
+
+		return 0;
+	}
+
+	sqe = event_get_sqe(poll->io_uring);
+
+	if (sqe == NULL) {
+		log_error("Could not modify poll request for %s event source (handle: %d): %s (%d)",
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// only the event mask is replaced, the poll request stays multishot
+	// and keeps its trigger mode
+	io_uring_prep_poll_update(sqe, (uintptr_t)poll, (uintptr_t)poll,
+	                          event_source->events & ~EVENT_EDGE,
+	                          IORING_POLL_UPDATE_EVENTS);
+	io_uring_sqe_set_data(sqe, NULL);
+
+	return 0;
+}
+
+void event_source_removed_platform(EventLoop *loop, EventSource *event_source) {
+	IOUringPoll *poll;
+	struct io_uring_sqe *sqe;
+
+	if (_use_epoll) {
+		event_source_removed_epoll(loop, event_source);
+
+		return;
+	}
+
+	poll = event_source->cold->io_uring_poll;
+
+	// detach the poll request from the event source, the EventSource struct
+	// might be freed before the removal of the poll request is completed
+	poll->event_source = NULL;
+	event_source->cold->io_uring_poll = NULL;
+
+	--poll->io_uring->poll_count;
+
+	if (!poll->armed) {
+		node_remove(&poll->node);
+		free(poll);
+
+		return;
+	}
+
+	sqe = event_get_sqe(poll->io_uring);
+
+	if (sqe == NULL) {
+		// the poll request stays armed, but its completions will be ignored
+		log_error("Could not remove poll request for %s event source (handle: %d): %s (%d)",
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	io_uring_prep_poll_remove(sqe, (uintptr_t)poll);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+
+static void event_handle_completion(struct io_uring_cqe *cqe) {
+	IOUringPoll *poll = io_uring_cqe_get_data(cqe);
+	EventSource *event_source;
+
+	// completion of a poll update or poll remove request. the poll request
+	// to be updated or removed might have terminated already
+	if (poll == NULL) {
+		if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY) {
+			log_warn("Could not update or remove poll request: %s (%d)",
+			         get_errno_name(-cqe->res), -cqe->res);
+		}
+
+		return;
+	}
+
+	event_source = poll->event_source;
+
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+		// the poll request terminated, this is its final completion
+		poll->armed = false;
+
+		if (event_source == NULL) {
+			node_remove(&poll->node);
+			free(poll);
+
+			return;
+		}
+
+		if (cqe->res < 0) {
+			log_error("Poll request for %s event source (handle: %d, name: %s) failed: %s (%d)",
+			          event_get_source_type_name(event_source->cold->type, false),
+			          event_source->cold->handle, event_source->cold->name,
+			          get_errno_name(-cqe->res), -cqe->res);
+
+			return;
+		}
+
+		// the kernel might terminate a multishot poll request, for example
+		// if the completion queue overflowed. re-arm it in this case
+		event_arm_poll(poll);
+	}
+
+	if (event_source != NULL && cqe->res > 0) {
+		event_handle_source(event_source, (uint32_t)cqe->res);
+	}
+}
+
+int event_run_platform(EventLoop *loop, EventCleanupFunction cleanup) {
+	IOUring *io_uring = loop->platform;
+	int result = -1;
+	int rc;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	unsigned int ready;
+	int timeout;
+	struct __kernel_timespec ts;
+
+	if (_use_epoll) {
+		return event_run_epoll(loop, cleanup);
+	}
+
+	loop->running = true;
+
+	cleanup();
+	event_loop_cleanup_sources(loop);
+
+	while (loop->running) {
+		// submit all queued poll requests and start to wait
+		log_event_debug("Starting to wait on %d event source(s)", io_uring->poll_count);
+
+		event_loop_wait_started(loop);
+
+		timeout = event_loop_get_timeout(loop);
+
+		if (timeout < 0) {
+			rc = io_uring_submit_and_wait(&io_uring->ring, 1);
+		} else {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+
+			rc = io_uring_submit_and_wait_timeout(&io_uring->ring, &cqe, 1, &ts, NULL);
+		}
+
+		event_loop_wait_finished(loop);
+
+		if (rc < 0) {
+			if (rc == -EINTR) {
+				log_debug("Waiting on io_uring got interrupted");
+
+				continue;
+			}
+
+			// the timeout expired or the completion queue overflowed, handle the
+			// available completions (if any) before submitting again
+			if (rc != -ETIME && rc != -EBUSY && rc != -EAGAIN) {
+				log_error("Could not wait on event source(s): %s (%d)",
+				          get_errno_name(-rc), -rc);
+
+				goto cleanup;
+			}
+		}
+
+		// handle completions. this loop assumes that event sources referenced
+		// by the poll requests are valid. because of this event_remove_source
+		// only marks event sources as removed, the actual removal is done after
+		// this loop by event_cleanup_sources
+		ready = 0;
+
+		io_uring_for_each_cqe(&io_uring->ring, head, cqe) {
+			if (loop->running) {
+				event_handle_completion(cqe);
+			}
+
+			++ready;
+		}
+
+		io_uring_cq_advance(&io_uring->ring, ready);
+
+		log_event_debug("Handled %u completion(s)", ready);
+
+		// call the functions of expired timers
+		event_loop_handle_timers(loop);
+
+		// call event functions again that stopped early and rearmed their
+		// event source, without waiting for new events for them
+		event_loop_handle_pending_sources(loop);
+
+		// call the flushes that were scheduled during this iteration
+		event_loop_handle_flushes(loop);
+
+		// now cleanup event sources that got marked as disconnected/removed
+		// during the event handling
+		cleanup();
+		event_loop_cleanup_sources(loop);
+	}
+
+	result = 0;
+
+cleanup:
+	loop->running = false;
+
+	return result;
+}
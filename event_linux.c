@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -32,32 +33,66 @@
 #include "log.h"
 #include "utils.h"
 
+#ifdef DAEMONLIB_WITH_IO_URING
+
+// event_io_uring.c provides the event_*_platform functions and falls back to
+// this epoll based implementation if the kernel refuses to set up io_uring
+#define event_init_platform event_init_epoll
+#define event_exit_platform event_exit_epoll
+#define event_source_added_platform event_source_added_epoll
+#define event_source_modified_platform event_source_modified_epoll
+#define event_source_removed_platform event_source_removed_epoll
+#define event_run_platform event_run_epoll
+
+#endif
+
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-static int _epollfd;
-static int _epollfd_event_count;
+typedef struct {
+	int epollfd;
+	int epollfd_event_count;
+} EPoll;
+
+int event_init_platform(EventLoop *loop) {
+	EPoll *epoll = calloc(1, sizeof(EPoll));
+
+	if (epoll == NULL) {
+		log_error("Could not allocate epoll state: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
 
-int event_init_platform(void) {
 	// create epollfd
-	_epollfd = epoll_create1(EPOLL_CLOEXEC);
+	epoll->epollfd = epoll_create1(EPOLL_CLOEXEC);
 
-	if (_epollfd < 0) {
+	if (epoll->epollfd < 0) {
 		log_error("Could not create epollfd: %s (%d)",
 		          get_errno_name(errno), errno);
 
+		free(epoll);
+
 		return -1;
 	}
 
-	_epollfd_event_count = 0;
+	epoll->epollfd_event_count = 0;
+
+	loop->platform = epoll;
 
 	return 0;
 }
 
-void event_exit_platform(void) {
-	robust_close(_epollfd); // FIXME: remove remaining events (if any) from epollfd?
+void event_exit_platform(EventLoop *loop) {
+	EPoll *epoll = loop->platform;
+
+	robust_close(epoll->epollfd); // FIXME: remove remaining events (if any) from epollfd?
+	free(epoll);
+
+	loop->platform = NULL;
 }
 
-int event_source_added_platform(EventSource *event_source) {
+int event_source_added_platform(EventLoop *loop, EventSource *event_source) {
+	EPoll *epoll = loop->platform;
 	struct epoll_event event;
 
 	memset(&event, 0, sizeof(event));
@@ -65,29 +100,30 @@ int event_source_added_platform(EventSource *event_source) {
 	event.events = event_source->events;
 	event.data.ptr = event_source;
 
-	if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, event_source->handle, &event) < 0) {
+	if (epoll_ctl(epoll->epollfd, EPOLL_CTL_ADD, event_source->cold->handle, &event) < 0) {
 		log_error("Could not add %s event source (handle: %d) to epollfd: %s (%d)",
-		          event_get_source_type_name(event_source->type, false),
-		          event_source->handle, get_errno_name(errno), errno);
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
 
 		return -1;
 	}
 
-	++_epollfd_event_count;
+	++epoll->epollfd_event_count;
 
 	return 0;
 }
 
-int event_source_modified_platform(EventSource *event_source) {
+int event_source_modified_platform(EventLoop *loop, EventSource *event_source) {
+	EPoll *epoll = loop->platform;
 	struct epoll_event event;
 
 	event.events = event_source->events;
 	event.data.ptr = event_source;
 
-	if (epoll_ctl(_epollfd, EPOLL_CTL_MOD, event_source->handle, &event) < 0) {
+	if (epoll_ctl(epoll->epollfd, EPOLL_CTL_MOD, event_source->cold->handle, &event) < 0) {
 		log_error("Could not modify %s event source (handle: %d) added to epollfd: %s (%d)",
-		          event_get_source_type_name(event_source->type, false),
-		          event_source->handle, get_errno_name(errno), errno);
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
 
 		return -1;
 	}
@@ -95,24 +131,26 @@ int event_source_modified_platform(EventSource *event_source) {
 	return 0;
 }
 
-void event_source_removed_platform(EventSource *event_source) {
+void event_source_removed_platform(EventLoop *loop, EventSource *event_source) {
+	EPoll *epoll = loop->platform;
 	struct epoll_event event;
 
 	event.events = event_source->events;
 	event.data.ptr = event_source;
 
-	if (epoll_ctl(_epollfd, EPOLL_CTL_DEL, event_source->handle, &event) < 0) {
+	if (epoll_ctl(epoll->epollfd, EPOLL_CTL_DEL, event_source->cold->handle, &event) < 0) {
 		log_error("Could not remove %s event source (handle: %d) from epollfd: %s (%d)",
-		          event_get_source_type_name(event_source->type, false),
-		          event_source->handle, get_errno_name(errno), errno);
+		          event_get_source_type_name(event_source->cold->type, false),
+		          event_source->cold->handle, get_errno_name(errno), errno);
 
 		return;
 	}
 
-	--_epollfd_event_count;
+	--epoll->epollfd_event_count;
 }
 
-int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction cleanup) {
+int event_run_platform(EventLoop *loop, EventCleanupFunction cleanup) {
+	EPoll *epoll = loop->platform;
 	int result = -1;
 	int i;
 	EventSource *event_source;
@@ -120,8 +158,6 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 	struct epoll_event *received_event;
 	int ready;
 
-	(void)event_sources;
-
 	if (array_create(&received_events, 32, sizeof(struct epoll_event), true) < 0) {
 		log_error("Could not create epoll event array: %s (%d)",
 		          get_errno_name(errno), errno);
@@ -129,13 +165,13 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 		return -1;
 	}
 
-	*running = true;
+	loop->running = true;
 
 	cleanup();
-	event_cleanup_sources();
+	event_loop_cleanup_sources(loop);
 
-	while (*running) {
-		if (array_resize(&received_events, _epollfd_event_count, NULL) < 0) {
+	while (loop->running) {
+		if (array_resize(&received_events, epoll->epollfd_event_count, NULL) < 0) {
 			log_error("Could not resize pollfd array: %s (%d)",
 			          get_errno_name(errno), errno);
 
@@ -144,10 +180,14 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 
 		// start to epoll
 		log_event_debug("Starting to epoll on %d event source(s)",
-		                _epollfd_event_count);
+		                epoll->epollfd_event_count);
+
+		event_loop_wait_started(loop);
 
-		ready = epoll_wait(_epollfd, (struct epoll_event *)received_events.bytes,
-		                   received_events.count, -1);
+		ready = epoll_wait(epoll->epollfd, (struct epoll_event *)received_events.bytes,
+		                   received_events.count, event_loop_get_timeout(loop));
+
+		event_loop_wait_finished(loop);
 
 		if (ready < 0) {
 			if (errno_interrupted()) {
@@ -169,7 +209,7 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 		// are valid. because of this event_remove_source only marks event
 		// sources as removed, the actual removal is done after this loop
 		// by event_cleanup_sources
-		for (i = 0; *running && i < ready; ++i) {
+		for (i = 0; loop->running && i < ready; ++i) {
 			received_event = array_get(&received_events, i);
 			event_source = received_event->data.ptr;
 
@@ -178,16 +218,26 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 
 		log_event_debug("Handled all ready event sources");
 
+		// call the functions of expired timers
+		event_loop_handle_timers(loop);
+
+		// call event functions again that stopped early and rearmed their
+		// event source, without waiting for new events for them
+		event_loop_handle_pending_sources(loop);
+
+		// call the flushes that were scheduled during this iteration
+		event_loop_handle_flushes(loop);
+
 		// now cleanup event sources that got marked as disconnected/removed
 		// during the event handling
 		cleanup();
-		event_cleanup_sources();
+		event_loop_cleanup_sources(loop);
 	}
 
 	result = 0;
 
 cleanup:
-	*running = false;
+	loop->running = false;
 
 	array_destroy(&received_events, NULL);
 
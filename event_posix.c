@@ -21,6 +21,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "event.h"
 
@@ -30,73 +31,212 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-int event_init_platform(void) {
-	return 0;
+// the pollfd array is kept in sync with the event sources by the added,
+// modified and removed hooks instead of being rebuilt on every iteration.
+// the event source array cannot be used to match pollfds to event sources,
+// because event_cleanup_sources removes items from it. therefore, a second
+// array stores the corresponding event source for each pollfd and each event
+// source stores the index of its pollfd.
+//
+// removing an event source only turns its pollfd into a hole (fd = -1) that
+// is ignored by poll, because the hook might be called while the pollfds
+// are iterated. the holes are compacted before the next call to poll, once
+// there are enough of them
+typedef struct {
+	Array pollfds; // struct pollfd
+	Array sources; // EventSource *, NULL for a hole
+	int hole_count;
+} PollSet;
+
+int event_init_platform(EventLoop *loop) {
+	int phase = 0;
+	PollSet *pollset = calloc(1, sizeof(PollSet));
+
+	if (pollset == NULL) {
+		log_error("Could not allocate poll state: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// create pollfd array
+	if (array_create(&pollset->pollfds, 32, sizeof(struct pollfd), true) < 0) {
+		log_error("Could not create pollfd array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// create pollfd source array
+	if (array_create(&pollset->sources, 32, sizeof(EventSource *), true) < 0) {
+		log_error("Could not create pollfd source array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	loop->platform = pollset;
+	phase = 3;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 2:
+		array_destroy(&pollset->pollfds, NULL);
+		// fall through
+
+	case 1:
+		free(pollset);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 3 ? 0 : -1;
 }
 
-void event_exit_platform(void) {
+void event_exit_platform(EventLoop *loop) {
+	PollSet *pollset = loop->platform;
+
+	array_destroy(&pollset->sources, NULL);
+	array_destroy(&pollset->pollfds, NULL);
+
+	free(pollset);
+
+	loop->platform = NULL;
 }
 
-int event_source_added_platform(EventSource *event_source) {
-	(void)event_source;
+int event_source_added_platform(EventLoop *loop, EventSource *event_source) {
+	PollSet *pollset = loop->platform;
+	struct pollfd *pollfd;
+	EventSource **source;
+
+	// a re-added event source got its pollfd turned into a hole on removal,
+	// it gets a new pollfd here like any other added event source
+	pollfd = array_append(&pollset->pollfds);
+
+	if (pollfd == NULL) {
+		log_error("Could not append to pollfd array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	source = array_append(&pollset->sources);
+
+	if (source == NULL) {
+		log_error("Could not append to pollfd source array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_remove(&pollset->pollfds, pollset->pollfds.count - 1, NULL);
+
+		return -1;
+	}
+
+	pollfd->fd = event_source->cold->handle;
+	pollfd->events = event_source->events & ~EVENT_EDGE;
+	pollfd->revents = 0;
+
+	*source = event_source;
+
+	event_source->cold->pollfd_index = pollset->pollfds.count - 1;
 
 	return 0;
 }
 
-int event_source_modified_platform(EventSource *event_source) {
-	(void)event_source;
+int event_source_modified_platform(EventLoop *loop, EventSource *event_source) {
+	PollSet *pollset = loop->platform;
+	struct pollfd *pollfd = array_get(&pollset->pollfds, event_source->cold->pollfd_index);
+
+	pollfd->events = event_source->events & ~EVENT_EDGE;
 
 	return 0;
 }
 
-void event_source_removed_platform(EventSource *event_source) {
-	(void)event_source;
+void event_source_removed_platform(EventLoop *loop, EventSource *event_source) {
+	PollSet *pollset = loop->platform;
+	struct pollfd *pollfd = array_get(&pollset->pollfds, event_source->cold->pollfd_index);
+	EventSource **source = array_get(&pollset->sources, event_source->cold->pollfd_index);
+
+	pollfd->fd = -1;
+	pollfd->events = 0;
+	pollfd->revents = 0;
+
+	*source = NULL;
+
+	event_source->cold->pollfd_index = -1;
+
+	++pollset->hole_count;
+}
+
+// move all pollfds behind the holes forward. this must not be done while
+// the pollfds are iterated
+static void event_compact_pollfds(PollSet *pollset) {
+	int i;
+	int k = 0;
+	struct pollfd *pollfds = (struct pollfd *)pollset->pollfds.bytes;
+	EventSource **sources = (EventSource **)pollset->sources.bytes;
+
+	for (i = 0; i < pollset->pollfds.count; ++i) {
+		if (sources[i] == NULL) {
+			continue;
+		}
+
+		if (i != k) {
+			pollfds[k] = pollfds[i];
+			sources[k] = sources[i];
+
+			sources[k]->cold->pollfd_index = k;
+		}
+
+		++k;
+	}
+
+	// cannot fail, because the arrays are only shrunk
+	array_resize(&pollset->pollfds, k, NULL);
+	array_resize(&pollset->sources, k, NULL);
+
+	pollset->hole_count = 0;
 }
 
-int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction cleanup) {
+static int event_poll(PollSet *pollset, int timeout) { // timeout in msec
+	return poll((struct pollfd *)pollset->pollfds.bytes, pollset->pollfds.count, timeout);
+}
+
+int event_run_platform(EventLoop *loop, EventCleanupFunction cleanup) {
+	PollSet *pollset = loop->platform;
 	int result = -1;
-	Array pollfds;
+	int count;
 	int i;
 	EventSource *event_source;
 	struct pollfd *pollfd;
 	int ready;
 	int handled;
 
-	// create pollfd array
-	if (array_create(&pollfds, 32, sizeof(struct pollfd), true) < 0) {
-		log_error("Could not create pollfd array: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		return -1;
-	}
-
-	*running = true;
+	loop->running = true;
 
 	cleanup();
-	event_cleanup_sources();
-
-	while (*running) {
-		// update pollfd array
-		if (array_resize(&pollfds, event_sources->count, NULL) < 0) {
-			log_error("Could not resize pollfd array: %s (%d)",
-			          get_errno_name(errno), errno);
+	event_loop_cleanup_sources(loop);
 
-			goto cleanup;
+	while (loop->running) {
+		// compact the pollfd array, if at least a quarter of it are holes
+		if (pollset->hole_count > 0 && pollset->hole_count * 4 >= pollset->pollfds.count) {
+			event_compact_pollfds(pollset);
 		}
 
-		for (i = 0; i < event_sources->count; ++i) {
-			event_source = array_get(event_sources, i);
-			pollfd = array_get(&pollfds, i);
+		// start to poll
+		log_event_debug("Starting to poll on %d event source(s)",
+		                pollset->pollfds.count - pollset->hole_count);
 
-			pollfd->fd = event_source->handle;
-			pollfd->events = event_source->events;
-			pollfd->revents = 0;
-		}
+		event_loop_wait_started(loop);
 
-		// start to poll
-		log_event_debug("Starting to poll on %d event source(s)", pollfds.count);
+		ready = event_poll(pollset, event_loop_get_timeout(loop));
 
-		ready = poll((struct pollfd *)pollfds.bytes, pollfds.count, -1);
+		event_loop_wait_finished(loop);
 
 		if (ready < 0) {
 			if (errno_interrupted()) {
@@ -115,44 +255,55 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 		log_event_debug("Poll returned %d event source(s) as ready", ready);
 
 		handled = 0;
+		count = pollset->pollfds.count;
 
-		// this loop assumes that event source array and pollfd array can be
-		// matched by index. this means that the first N items of the event
-		// source array (with N = items in pollfd array) are not removed
-		// or replaced during the iteration over the pollfd array. because
-		// of this event_remove_source only marks event sources as removed,
-		// the actual removal is done after this loop by event_cleanup_sources
-		for (i = 0; *running && i < pollfds.count && ready > handled; ++i) {
-			pollfd = array_get(&pollfds, i);
+		// event sources added during the iteration are appended to the pollfd
+		// array and have no revents yet. event sources removed during the
+		// iteration leave a hole behind without revents, the actual removal
+		// of the event source is done after this loop by event_cleanup_sources.
+		// the pollfd array might get reallocated by an added event source,
+		// therefore the pollfd pointer has to be fetched for every index
+		for (i = 0; loop->running && i < count && ready > handled; ++i) {
+			pollfd = array_get(&pollset->pollfds, i);
 
 			if (pollfd->revents == 0) {
 				continue;
 			}
 
-			event_handle_source(array_get(event_sources, i), pollfd->revents);
+			event_source = *(EventSource **)array_get(&pollset->sources, i);
+
+			event_handle_source(event_source, pollfd->revents);
 
 			++handled;
 		}
 
 		if (ready == handled) {
 			log_event_debug("Handled all ready event sources");
-		} else if (*running) {
-			log_warn("Handled only %d of %d ready event source(s)",
-			         handled, ready);
+		} else if (loop->running) {
+			log_event_debug("Handled %d of %d ready event source(s), the others got removed",
+			                handled, ready);
 		}
 
+		// call the functions of expired timers
+		event_loop_handle_timers(loop);
+
+		// call event functions again that stopped early and rearmed their
+		// event source, without waiting for new events for them
+		event_loop_handle_pending_sources(loop);
+
+		// call the flushes that were scheduled during this iteration
+		event_loop_handle_flushes(loop);
+
 		// now cleanup event sources that got marked as disconnected/removed
 		// during the event handling
 		cleanup();
-		event_cleanup_sources();
+		event_loop_cleanup_sources(loop);
 	}
 
 	result = 0;
 
 cleanup:
-	*running = false;
-
-	array_destroy(&pollfds, NULL);
+	loop->running = false;
 
 	return result;
 }
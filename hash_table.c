@@ -0,0 +1,212 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * hash_table.c: Hash table specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a HashTable object maps 64 bit keys to non-NULL pointers. it uses open
+ * addressing with linear probing and keeps at least half of its buckets
+ * unused to keep the probe sequences short. removing an item shifts the
+ * following items of the same probe sequence back, instead of leaving
+ * tombstones behind. therefore, lookups never degrade over time, even if
+ * items are inserted and removed at a high rate.
+ *
+ * the HashTable object doesn't own the stored values, it only stores the
+ * pointers. the caller is responsible for keeping them valid as long as
+ * they are stored in the table.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "hash_table.h"
+
+#define MIN_ALLOCATED 16
+
+// the 64 bit finalizer of splitmix64. it spreads keys that only differ in a
+// few low bits (e.g. file descriptors) over the whole table
+static uint64_t hash_table_hash(uint64_t key) {
+	key ^= key >> 30;
+	key *= UINT64_C(0xBF58476D1CE4E5B9);
+	key ^= key >> 27;
+	key *= UINT64_C(0x94D049BB133111EB);
+	key ^= key >> 31;
+
+	return key;
+}
+
+// returns the index of the bucket that stores KEY or of the unused bucket
+// that terminates the probe sequence for KEY
+static int hash_table_find(HashTable *table, uint64_t key) {
+	int mask = table->allocated - 1;
+	int i = (int)(hash_table_hash(key) & (uint64_t)mask);
+
+	while (table->buckets[i].value != NULL && table->buckets[i].key != key) {
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+// returns -1 on error (sets errno) or 0 on success
+static int hash_table_grow(HashTable *table, int allocated) {
+	HashTableBucket *buckets = table->buckets;
+	int old_allocated = table->allocated;
+	int i;
+	int k;
+
+	table->buckets = calloc(allocated, sizeof(HashTableBucket));
+
+	if (table->buckets == NULL) {
+		table->buckets = buckets;
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	table->allocated = allocated;
+
+	for (i = 0; i < old_allocated; ++i) {
+		if (buckets[i].value != NULL) {
+			k = hash_table_find(table, buckets[i].key);
+
+			table->buckets[k] = buckets[i];
+		}
+	}
+
+	free(buckets);
+
+	return 0;
+}
+
+// creates an empty (count == 0) HashTable object and reserves memory for at
+// least the number of items specified by RESERVE (>= 0) without the need to
+// grow the table.
+//
+// returns -1 on error (sets errno) or 0 on success
+int hash_table_create(HashTable *table, int reserve) {
+	int allocated = MIN_ALLOCATED;
+
+	while (allocated < reserve * 2) {
+		allocated *= 2;
+	}
+
+	table->allocated = allocated;
+	table->count = 0;
+	table->buckets = calloc(allocated, sizeof(HashTableBucket));
+
+	if (table->buckets == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// destroys a HashTable object and frees the underlying memory. if an item
+// destroy function DESTROY is given then it is called for each stored value
+// (with the value as the only parameter) before the memory is freed.
+void hash_table_destroy(HashTable *table, ItemDestroyFunction destroy) {
+	int i;
+
+	if (destroy != NULL) {
+		for (i = 0; i < table->allocated; ++i) {
+			if (table->buckets[i].value != NULL) {
+				destroy(table->buckets[i].value);
+			}
+		}
+	}
+
+	free(table->buckets);
+}
+
+// stores VALUE (!= NULL) under KEY in a HashTable object. each KEY can be
+// stored only once.
+//
+// returns -1 on error (sets errno) or 0 on success
+int hash_table_insert(HashTable *table, uint64_t key, void *value) {
+	int i;
+
+	if (value == NULL) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if ((table->count + 1) * 2 > table->allocated &&
+	    hash_table_grow(table, table->allocated * 2) < 0) {
+		return -1;
+	}
+
+	i = hash_table_find(table, key);
+
+	if (table->buckets[i].value != NULL) {
+		errno = EEXIST;
+
+		return -1;
+	}
+
+	table->buckets[i].key = key;
+	table->buckets[i].value = value;
+
+	++table->count;
+
+	return 0;
+}
+
+// removes KEY from a HashTable object.
+//
+// returns the value that was stored under KEY or NULL if KEY was not stored
+void *hash_table_remove(HashTable *table, uint64_t key) {
+	int mask = table->allocated - 1;
+	int i = hash_table_find(table, key);
+	int k;
+	int home;
+	void *value = table->buckets[i].value;
+
+	if (value == NULL) {
+		return NULL;
+	}
+
+	// shift following items of the probe sequence back into the hole, unless
+	// their home bucket is cyclically located between the hole and themselves
+	for (k = (i + 1) & mask; table->buckets[k].value != NULL; k = (k + 1) & mask) {
+		home = (int)(hash_table_hash(table->buckets[k].key) & (uint64_t)mask);
+
+		if ((i <= k) ? (i < home && home <= k) : (i < home || home <= k)) {
+			continue;
+		}
+
+		table->buckets[i] = table->buckets[k];
+		i = k;
+	}
+
+	table->buckets[i].value = NULL;
+
+	--table->count;
+
+	return value;
+}
+
+// returns the value stored under KEY or NULL if KEY is not stored
+void *hash_table_get(HashTable *table, uint64_t key) {
+	return table->buckets[hash_table_find(table, key)].value;
+}
@@ -0,0 +1,48 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * hash_table.h: Hash table specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_HASH_TABLE_H
+#define DAEMONLIB_HASH_TABLE_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+typedef struct {
+	uint64_t key;
+	void *value; // NULL marks an unused bucket
+} HashTableBucket;
+
+typedef struct {
+	int allocated; // number of allocated buckets, always a power of two
+	int count; // number of stored items
+	HashTableBucket *buckets;
+} HashTable;
+
+int hash_table_create(HashTable *table, int reserve);
+void hash_table_destroy(HashTable *table, ItemDestroyFunction destroy);
+
+int hash_table_insert(HashTable *table, uint64_t key, void *value);
+void *hash_table_remove(HashTable *table, uint64_t key);
+
+void *hash_table_get(HashTable *table, uint64_t key);
+
+#endif // DAEMONLIB_HASH_TABLE_H
@@ -47,6 +47,7 @@ int io_create(IO *io, const char *type,
 	io->destroy = destroy;
 	io->read = read;
 	io->write = write;
+	io->write_vector = NULL;
 	io->status = status;
 
 	return 0;
@@ -80,6 +81,19 @@ int io_write(IO *io, const void *buffer, int length) {
 	return io->write(io, buffer, length);
 }
 
+// writes the buffers of COUNT (1 to IO_MAX_VECTOR_COUNT) VECTORS in order, as
+// if they were one contiguous buffer, and returns the number of bytes written.
+// like io_write this can end anywhere, also in the middle of a vector. if the
+// IO object has no vectored write function then only the first vector is
+// written. sets errno on error
+int io_write_vector(IO *io, const IOVector *vectors, int count) {
+	if (io->write_vector == NULL) {
+		return io_write(io, vectors[0].buffer, vectors[0].length);
+	}
+
+	return io->write_vector(io, vectors, count);
+}
+
 // sets errno on error
 int io_status(IO *io, IOStatus *status) {
 	if (io->status == NULL) {
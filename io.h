@@ -41,15 +41,23 @@ typedef int IOHandle;
 
 #define IO_CONTINUE (-2)
 
+#define IO_MAX_VECTOR_COUNT 64
+
 typedef struct _IO IO;
 
 typedef struct {
 	int64_t size; // bytes, -1 = unknown
 } IOStatus;
 
+typedef struct {
+	const void *buffer;
+	int length;
+} IOVector;
+
 typedef void (*IODestroyFunction)(IO *io);
 typedef int (*IOReadFunction)(IO *io, void *buffer, int length);
 typedef int (*IOWriteFunction)(IO *io, const void *buffer, int length);
+typedef int (*IOWriteVectorFunction)(IO *io, const IOVector *vectors, int count);
 typedef int (*IOStatusFunction)(IO *io, IOStatus *status);
 
 struct _IO {
@@ -59,6 +67,7 @@ struct _IO {
 	IODestroyFunction destroy;
 	IOReadFunction read;
 	IOWriteFunction write;
+	IOWriteVectorFunction write_vector; // optional, set after io_create
 	IOStatusFunction status;
 };
 
@@ -71,6 +80,7 @@ void io_destroy(IO *io);
 
 int io_read(IO *io, void *buffer, int length);
 int io_write(IO *io, const void *buffer, int length);
+int io_write_vector(IO *io, const IOVector *vectors, int count);
 int io_status(IO *io, IOStatus *status);
 
 #endif // DAEMONLIB_IO_H
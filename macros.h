@@ -50,6 +50,12 @@
 	#define STATIC_ASSERT(condition, message) // FIXME
 #endif
 
+#ifdef _MSC_VER
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
 // if __GNUC_PREREQ is not defined by now then define it to always be false
 #ifndef __GNUC_PREREQ
 	#define __GNUC_PREREQ(major, minor) 0
@@ -0,0 +1,458 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet-pool-bench.c: Benchmark for packet allocation and copying
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * standalone benchmark for shared_packet.c and packet_pool.c. it simulates
+ * broadcasting packets to the backlogs of several clients, like Writer does
+ * for callbacks, at a fixed packet rate. each packet is handed to FANOUT
+ * backlogs in one of three modes:
+ *
+ * - value:  each backlog gets its own copy of the packet, as before
+ *           SharedPacket existed
+ * - malloc: each backlog gets a SharedPacket handle, allocated with malloc
+ * - pool:   each backlog gets a SharedPacket handle, allocated from the
+ *           packet pool
+ *
+ * the backlogs are drained and the handles released either by the same
+ * thread or by a second thread, like a client handled by another event loop.
+ * for each mode it measures the CPU time per packet, the number of calls to
+ * malloc, calloc and realloc per packet and per second (counted by wrapping
+ * them, glibc only, otherwise -1 is reported) and the number of packet bytes
+ * copied per packet. the results are written to stdout as CSV.
+ *
+ * build with:
+ *
+ *   gcc -O2 -o packet-pool-bench packet-pool-bench.c shared_packet.c packet_pool.c \
+ *       slab.c array.c threads_posix.c utils.c -lpthread
+ *
+ * usage:
+ *
+ *   packet-pool-bench [--rate <packets/s>] [--duration <sec>] [--fanout <n>] [--no-header]
+ *
+ * a rate of 0 sends packets as fast as possible.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet_pool.h"
+#include "shared_packet.h"
+#include "threads.h"
+#include "utils.h"
+
+#define DEFAULT_RATE 100000 // packets per second
+#define DEFAULT_DURATION 1 // seconds
+#define DEFAULT_FANOUT 4 // backlogs per packet
+#define BATCH_SIZE 100 // packets sent between two pacing checks
+#define RING_SIZE 4096 // slots, power of two
+#define IDLE_PAUSE 50 // microseconds a thread sleeps if it cannot make progress
+
+typedef enum {
+	MODE_VALUE = 0,
+	MODE_MALLOC,
+	MODE_POOL,
+	MODE_COUNT
+} Mode;
+
+static const char *_mode_names[MODE_COUNT] = { "value", "malloc", "pool" };
+
+// single producer, single consumer ring of backlog entries. a slot either
+// holds a packet copy or a SharedPacket pointer
+typedef struct {
+	uint8_t slots[RING_SIZE][sizeof(Packet)];
+	uint32_t head; // written by the consumer
+	uint32_t tail; // written by the producer
+	bool done; // set by the producer after its last entry
+} Ring;
+
+typedef struct {
+	Mode mode;
+	int rate;
+	int duration;
+	int fanout;
+	bool threaded;
+	Ring ring;
+	uint64_t copied_bytes;
+	uint64_t checksum; // keeps the consumer from being optimized away
+} Bench;
+
+typedef struct {
+	uint64_t packets;
+	double packet_rate; // packets per second
+	double cpu_per_packet; // nanoseconds
+	double allocs_per_packet; // -1 if not available
+	double allocs_per_second; // -1 if not available
+	double copied_per_packet; // bytes
+} BenchResult;
+
+static Bench _bench;
+
+#ifdef __GLIBC__
+
+static uint64_t _alloc_count = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	__atomic_fetch_add(&_alloc_count, 1, __ATOMIC_RELAXED);
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	__atomic_fetch_add(&_alloc_count, 1, __ATOMIC_RELAXED);
+
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__atomic_fetch_add(&_alloc_count, 1, __ATOMIC_RELAXED);
+
+	return __libc_realloc(ptr, size);
+}
+
+// returns -1 if allocations cannot be counted
+static int64_t get_alloc_count(void) {
+	return (int64_t)__atomic_load_n(&_alloc_count, __ATOMIC_RELAXED);
+}
+
+#else
+
+// returns -1 if allocations cannot be counted
+static int64_t get_alloc_count(void) {
+	return -1;
+}
+
+#endif
+
+static uint64_t nanotime(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// fills PACKET with a callback of 8 to 80 bytes, like a mix of real callbacks
+static void fill_packet(Packet *packet, uint64_t index) {
+	int length = (int)sizeof(PacketHeader) + (int)(index * 7 % 73);
+
+	memset(packet, 0, sizeof(Packet));
+
+	packet->header.uid = (uint32_t)index;
+	packet->header.length = (uint8_t)length;
+	packet->header.function_id = (uint8_t)(index % 32 + 1);
+	packet->payload[0] = (uint8_t)index;
+}
+
+static void *ring_get_writable_slot(Ring *ring) {
+	uint32_t head;
+
+	for (;;) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		if (ring->tail - head < RING_SIZE) {
+			return ring->slots[ring->tail % RING_SIZE];
+		}
+
+		if (!_bench.threaded) {
+			return NULL;
+		}
+
+		microsleep(IDLE_PAUSE);
+	}
+}
+
+static void ring_commit_slot(Ring *ring) {
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+// drains all entries that are currently in the ring.
+//
+// returns the number of drained entries
+static int ring_drain(Ring *ring) {
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint32_t head = ring->head;
+	uint8_t *slot;
+	SharedPacket *shared_packet;
+	int count = 0;
+
+	for (; head != tail; ++head, ++count) {
+		slot = ring->slots[head % RING_SIZE];
+
+		if (_bench.mode == MODE_VALUE) {
+			// a real backlog would write the packet to a socket here
+			_bench.checksum += ((Packet *)slot)->header.length;
+		} else {
+			memcpy(&shared_packet, slot, sizeof(shared_packet));
+
+			_bench.checksum += shared_packet->packet.header.length;
+
+			shared_packet_release(shared_packet);
+		}
+	}
+
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+static void consumer(void *opaque) {
+	Ring *ring = opaque;
+	bool done;
+
+	for (;;) {
+		// load done before draining, otherwise the last entries might be
+		// missed if they are added between draining and loading done
+		done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+
+		if (ring_drain(ring) == 0) {
+			if (done) {
+				break;
+			}
+
+			microsleep(IDLE_PAUSE);
+		}
+	}
+}
+
+// pushes one packet to all backlogs.
+//
+// returns -1 on error or 0 on success
+static int send_packet(Packet *packet) {
+	SharedPacket *shared_packet = NULL;
+	void *slot;
+	int i;
+
+	if (_bench.mode != MODE_VALUE) {
+		shared_packet = shared_packet_create(packet);
+
+		if (shared_packet == NULL) {
+			fprintf(stderr, "Could not create shared packet: %s\n", strerror(errno));
+
+			return -1;
+		}
+
+		_bench.copied_bytes += packet->header.length;
+	}
+
+	for (i = 0; i < _bench.fanout; ++i) {
+		slot = ring_get_writable_slot(&_bench.ring);
+
+		if (slot == NULL) {
+			ring_drain(&_bench.ring);
+
+			slot = ring_get_writable_slot(&_bench.ring);
+		}
+
+		if (shared_packet == NULL) {
+			memcpy(slot, packet, packet->header.length);
+
+			_bench.copied_bytes += packet->header.length;
+		} else {
+			shared_packet_acquire(shared_packet);
+			memcpy(slot, &shared_packet, sizeof(shared_packet));
+		}
+
+		ring_commit_slot(&_bench.ring);
+	}
+
+	if (shared_packet != NULL) {
+		shared_packet_release(shared_packet); // drop the reference of the sender
+	}
+
+	return 0;
+}
+
+// returns -1 on error or 0 on success
+static int measure(Mode mode, bool threaded, BenchResult *result) {
+	Thread thread;
+	Packet packet;
+	uint64_t total = (uint64_t)_bench.rate * _bench.duration;
+	uint64_t wall_started;
+	uint64_t cpu_started;
+	uint64_t elapsed;
+	uint64_t due;
+	uint64_t now;
+	int64_t allocs_started;
+	int64_t allocs;
+	int rc = 0;
+	int i;
+
+	_bench.mode = mode;
+	_bench.threaded = threaded;
+	_bench.ring.head = 0;
+	_bench.ring.tail = 0;
+	_bench.ring.done = false;
+	_bench.copied_bytes = 0;
+
+	if (mode == MODE_POOL && packet_pool_init() < 0) {
+		fprintf(stderr, "Could not initialize packet pool\n");
+
+		return -1;
+	}
+
+	if (threaded) {
+		thread_create(&thread, consumer, &_bench.ring);
+	}
+
+	if (_bench.rate == 0) {
+		total = (uint64_t)_bench.duration * 1000000; // as fast as possible
+	}
+
+	allocs_started = get_alloc_count();
+	wall_started = nanotime(CLOCK_MONOTONIC);
+	cpu_started = nanotime(CLOCK_PROCESS_CPUTIME_ID);
+
+	for (result->packets = 0; result->packets < total && rc == 0; ) {
+		for (i = 0; i < BATCH_SIZE && result->packets < total; ++i, ++result->packets) {
+			fill_packet(&packet, result->packets);
+
+			if (send_packet(&packet) < 0) {
+				rc = -1;
+
+				break;
+			}
+		}
+
+		if (!threaded) {
+			ring_drain(&_bench.ring);
+		}
+
+		if (_bench.rate > 0) {
+			due = wall_started + result->packets * 1000000000 / _bench.rate;
+			now = nanotime(CLOCK_MONOTONIC);
+
+			if (due > now) {
+				microsleep((uint32_t)((due - now) / 1000));
+			}
+		}
+	}
+
+	if (threaded) {
+		__atomic_store_n(&_bench.ring.done, true, __ATOMIC_RELEASE);
+
+		thread_join(&thread);
+		thread_destroy(&thread);
+	}
+
+	allocs = get_alloc_count();
+	elapsed = nanotime(CLOCK_MONOTONIC) - wall_started;
+
+	result->cpu_per_packet = (double)(nanotime(CLOCK_PROCESS_CPUTIME_ID) - cpu_started) / result->packets;
+	result->packet_rate = (double)result->packets * 1000000000.0 / elapsed;
+	result->copied_per_packet = (double)_bench.copied_bytes / result->packets;
+
+	if (allocs_started < 0 || allocs < 0) {
+		result->allocs_per_packet = -1;
+		result->allocs_per_second = -1;
+	} else {
+		result->allocs_per_packet = (double)(allocs - allocs_started) / result->packets;
+		result->allocs_per_second = (double)(allocs - allocs_started) * 1000000000.0 / elapsed;
+	}
+
+	if (mode == MODE_POOL) {
+		// the consumer thread might have exited with objects in its cache,
+		// packet_pool_exit frees their memory anyway
+		packet_pool_exit();
+	}
+
+	return rc;
+}
+
+static void print_usage(const char *name) {
+	fprintf(stderr, "usage: %s [--rate <packets/s>] [--duration <sec>] [--fanout <n>] [--no-header]\n",
+	        name);
+}
+
+int main(int argc, char **argv) {
+	bool header = true;
+	int mode;
+	int threads;
+	int i;
+	BenchResult result;
+	int rc = 0;
+
+	_bench.rate = DEFAULT_RATE;
+	_bench.duration = DEFAULT_DURATION;
+	_bench.fanout = DEFAULT_FANOUT;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+			_bench.rate = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+			_bench.duration = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--fanout") == 0 && i + 1 < argc) {
+			_bench.fanout = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--no-header") == 0) {
+			header = false;
+		} else {
+			print_usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (_bench.rate < 0 || _bench.duration <= 0 || _bench.fanout <= 0 ||
+	    _bench.fanout > RING_SIZE) {
+		print_usage(argv[0]);
+
+		return 1;
+	}
+
+	if (header) {
+		printf("mode,threads,fanout,target_rate,packets,packets_per_sec,cpu_nsec_per_packet,"
+		       "allocs_per_packet,allocs_per_sec,copied_bytes_per_packet\n");
+	}
+
+	for (mode = 0; mode < MODE_COUNT; ++mode) {
+		for (threads = 1; threads <= 2; ++threads) {
+			memset(&result, 0, sizeof(result));
+
+			if (measure(mode, threads == 2, &result) < 0) {
+				fprintf(stderr, "Benchmark failed for mode %s\n", _mode_names[mode]);
+
+				rc = 1;
+
+				continue;
+			}
+
+			printf("%s,%d,%d,%d,%" PRIu64 ",%.0f,%.1f,%.3f,%.0f,%.1f\n",
+			       _mode_names[mode], threads, _bench.fanout, _bench.rate, result.packets,
+			       result.packet_rate, result.cpu_per_packet, result.allocs_per_packet,
+			       result.allocs_per_second, result.copied_per_packet);
+
+			fflush(stdout);
+		}
+	}
+
+	// print the checksum to stderr, so the consumer cannot be optimized away
+	fprintf(stderr, "checksum %" PRIu64 "\n", _bench.checksum);
+
+	return rc;
+}
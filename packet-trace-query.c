@@ -0,0 +1,619 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet-trace-query.c: Query tool for packet trace files
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * standalone tool to query packet trace files written by packet_trace.c. it
+ * maps the file and uses its index to only look at the blocks of records
+ * that can contain the requested time window or trace ID. if the index is
+ * missing, because the traced program didn't exit normally, then the index
+ * is rebuilt in memory first.
+ *
+ * build with:
+ *
+ *   gcc -O2 -o packet-trace-query packet-trace-query.c base58.c hash_table.c utils.c
+ *
+ * usage:
+ *
+ *   packet-trace-query <file> info
+ *   packet-trace-query <file> records [--from <usec>] [--to <usec>] [--trace-id <id>]
+ *   packet-trace-query <file> summary [--from <usec>] [--to <usec>]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base58.h"
+#include "hash_table.h"
+#include "packet_trace.h"
+#include "utils.h"
+
+#define SPAN_MAX_PENDING 4 // requests per span key
+
+typedef struct {
+	uint64_t from; // microseconds
+	uint64_t to; // microseconds
+	uint64_t trace_id; // 0 = any
+} Query;
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	const PacketTraceFileHeader *header;
+	const PacketTraceRecord *records;
+	uint64_t record_count;
+	PacketTraceIndexEntry *index; // either points into DATA or is allocated
+	uint64_t index_count;
+	bool index_allocated;
+} TraceFile;
+
+typedef struct {
+	uint64_t last_response_trace_id;
+	int pending_count;
+	uint64_t pending_trace_ids[SPAN_MAX_PENDING]; // oldest first
+	uint64_t pending_timestamps[SPAN_MAX_PENDING]; // microseconds
+} SpanKey;
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+	uint64_t count;
+	uint64_t total_latency;
+	uint64_t min_latency;
+	uint64_t max_latency;
+	uint64_t histogram[PACKET_TRACE_SPAN_HISTOGRAM_SIZE];
+} SpanSummary;
+
+static void update_range(uint64_t *min, uint64_t *max, uint64_t value) {
+	if (*min == 0 || value < *min) {
+		*min = value;
+	}
+
+	if (value > *max) {
+		*max = value;
+	}
+}
+
+static void index_entry_update(PacketTraceIndexEntry *entry, const PacketTraceRecord *record) {
+	uint64_t min;
+	uint64_t max;
+
+	if (record->timestamp < entry->min_timestamp) {
+		entry->min_timestamp = record->timestamp;
+	}
+
+	if (record->timestamp > entry->max_timestamp) {
+		entry->max_timestamp = record->timestamp;
+	}
+
+	if (record->trace_id == 0) {
+		return;
+	}
+
+	// the index entries are packed, so update copies of the range
+	if ((record->trace_id & 1) == 0) {
+		min = entry->min_request_trace_id;
+		max = entry->max_request_trace_id;
+
+		update_range(&min, &max, record->trace_id);
+
+		entry->min_request_trace_id = min;
+		entry->max_request_trace_id = max;
+	} else {
+		min = entry->min_response_trace_id;
+		max = entry->max_response_trace_id;
+
+		update_range(&min, &max, record->trace_id);
+
+		entry->min_response_trace_id = min;
+		entry->max_response_trace_id = max;
+	}
+}
+
+// returns -1 on error (sets errno) or 0 on success
+static int trace_file_rebuild_index(TraceFile *file) {
+	uint64_t block_count = (file->record_count + PACKET_TRACE_BLOCK_RECORD_COUNT - 1) / PACKET_TRACE_BLOCK_RECORD_COUNT;
+	uint64_t i;
+	PacketTraceIndexEntry *entry = NULL;
+
+	file->index = calloc(block_count > 0 ? block_count : 1, sizeof(PacketTraceIndexEntry));
+
+	if (file->index == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	file->index_count = block_count;
+	file->index_allocated = true;
+
+	for (i = 0; i < file->record_count; ++i) {
+		if (i % PACKET_TRACE_BLOCK_RECORD_COUNT == 0) {
+			entry = &file->index[i / PACKET_TRACE_BLOCK_RECORD_COUNT];
+			entry->first_record = i;
+			entry->min_timestamp = UINT64_MAX;
+		}
+
+		index_entry_update(entry, &file->records[i]);
+	}
+
+	return 0;
+}
+
+// returns -1 on error (prints a message) or 0 on success
+static int trace_file_open(TraceFile *file, const char *path) {
+	int fd;
+	struct stat st;
+	const PacketTraceFileHeader *header;
+	uint64_t available;
+
+	memset(file, 0, sizeof(*file));
+
+	fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Could not get size of %s: %s\n", path, strerror(errno));
+		close(fd);
+
+		return -1;
+	}
+
+	if ((size_t)st.st_size < sizeof(PacketTraceFileHeader)) {
+		fprintf(stderr, "%s is too small to be a packet trace file\n", path);
+		close(fd);
+
+		return -1;
+	}
+
+	file->size = (size_t)st.st_size;
+	file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (file->data == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+
+		return -1;
+	}
+
+	header = (const PacketTraceFileHeader *)file->data;
+	file->header = header;
+
+	if (memcmp(header->magic, PACKET_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != PACKET_TRACE_VERSION ||
+	    header->header_length != sizeof(PacketTraceFileHeader) ||
+	    header->record_length != sizeof(PacketTraceRecord) ||
+	    header->block_record_count != PACKET_TRACE_BLOCK_RECORD_COUNT ||
+	    header->string_length != PACKET_TRACE_STRING_LENGTH ||
+	    header->record_offset > file->size) {
+		fprintf(stderr, "%s is not a packet trace file (version %d)\n", path, PACKET_TRACE_VERSION);
+		munmap((void *)file->data, file->size);
+
+		return -1;
+	}
+
+	// the file might have been cut short if the program didn't exit normally
+	available = (file->size - header->record_offset) / sizeof(PacketTraceRecord);
+
+	file->records = (const PacketTraceRecord *)(file->data + header->record_offset);
+	file->record_count = header->record_count < available ? header->record_count : available;
+
+	if (header->index_offset != 0 &&
+	    header->index_offset + header->index_count * sizeof(PacketTraceIndexEntry) <= file->size &&
+	    header->index_count == (file->record_count + PACKET_TRACE_BLOCK_RECORD_COUNT - 1) / PACKET_TRACE_BLOCK_RECORD_COUNT) {
+		file->index = (PacketTraceIndexEntry *)(file->data + header->index_offset);
+		file->index_count = header->index_count;
+	} else {
+		fprintf(stderr, "Index of %s is missing, rebuilding it\n", path);
+
+		if (trace_file_rebuild_index(file) < 0) {
+			fprintf(stderr, "Could not rebuild index: %s\n", strerror(errno));
+			munmap((void *)file->data, file->size);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void trace_file_close(TraceFile *file) {
+	if (file->index_allocated) {
+		free(file->index);
+	}
+
+	munmap((void *)file->data, file->size);
+}
+
+static const char *trace_file_get_filename(TraceFile *file, uint32_t id) {
+	const char *name;
+
+	if (id >= file->header->string_count) {
+		return "<unknown>";
+	}
+
+	name = (const char *)(file->data + file->header->string_table_offset +
+	                      (uint64_t)id * PACKET_TRACE_STRING_LENGTH);
+
+	return name[0] != '\0' ? name : "<unknown>";
+}
+
+static bool block_matches(const PacketTraceIndexEntry *entry, const Query *query) {
+	if (entry->max_timestamp < query->from || entry->min_timestamp > query->to) {
+		return false;
+	}
+
+	if (query->trace_id == 0) {
+		return true;
+	}
+
+	if ((query->trace_id & 1) == 0) {
+		return entry->min_request_trace_id != 0 &&
+		       entry->min_request_trace_id <= query->trace_id &&
+		       query->trace_id <= entry->max_request_trace_id;
+	}
+
+	return entry->min_response_trace_id != 0 &&
+	       entry->min_response_trace_id <= query->trace_id &&
+	       query->trace_id <= entry->max_response_trace_id;
+}
+
+static bool record_matches(const PacketTraceRecord *record, const Query *query) {
+	if (record->timestamp < query->from || record->timestamp > query->to) {
+		return false;
+	}
+
+	return query->trace_id == 0 || record->trace_id == query->trace_id;
+}
+
+typedef void (*RecordFunction)(TraceFile *file, const PacketTraceRecord *record, void *opaque);
+
+// calls FUNCTION for all matching records of all matching blocks
+static void trace_file_query(TraceFile *file, const Query *query,
+                             RecordFunction function, void *opaque) {
+	uint64_t block;
+	uint64_t i;
+	uint64_t end;
+
+	for (block = 0; block < file->index_count; ++block) {
+		if (!block_matches(&file->index[block], query)) {
+			continue;
+		}
+
+		i = file->index[block].first_record;
+		end = i + PACKET_TRACE_BLOCK_RECORD_COUNT;
+
+		if (end > file->record_count) {
+			end = file->record_count;
+		}
+
+		for (; i < end; ++i) {
+			if (record_matches(&file->records[i], query)) {
+				function(file, &file->records[i], opaque);
+			}
+		}
+	}
+}
+
+static void print_record(TraceFile *file, const PacketTraceRecord *record, void *opaque) {
+	uint64_t *last_timestamp = opaque;
+	char base58[BASE58_MAX_LENGTH];
+
+	if (*last_timestamp == 0) {
+		*last_timestamp = record->timestamp;
+	}
+
+	printf("I: %20" PRIu64 ", T: %" PRIu64 " %+10" PRId64 ", U: %-6s, L: %3u, F: %3u, S: %2u, R: %u, E: %u -> %s:%d\n",
+	       record->trace_id, record->timestamp,
+	       (int64_t)(record->timestamp - *last_timestamp),
+	       base58_encode(base58, uint32_from_le(record->header.uid)),
+	       record->header.length, record->header.function_id,
+	       (record->header.sequence_number_and_options >> 4) & 0x0F,
+	       (record->header.sequence_number_and_options >> 3) & 0x01,
+	       (record->header.error_code_and_future_use >> 6) & 0x03,
+	       trace_file_get_filename(file, record->filename_id), record->line);
+
+	*last_timestamp = record->timestamp;
+}
+
+typedef struct {
+	HashTable keys; // (uid, function_id, sequence_number) -> SpanKey
+	HashTable summaries; // (uid, function_id) -> SpanSummary
+} SpanState;
+
+static void pop_pending(SpanKey *span_key) {
+	--span_key->pending_count;
+
+	memmove(span_key->pending_trace_ids, span_key->pending_trace_ids + 1,
+	        span_key->pending_count * sizeof(uint64_t));
+	memmove(span_key->pending_timestamps, span_key->pending_timestamps + 1,
+	        span_key->pending_count * sizeof(uint64_t));
+}
+
+static void add_latency(SpanState *state, const PacketHeader *header, uint64_t latency) {
+	uint64_t key = ((uint64_t)header->uid << 8) | header->function_id;
+	SpanSummary *summary = hash_table_get(&state->summaries, key);
+	int bucket = latency == 0 ? 0 : 64 - __builtin_clzll(latency);
+
+	if (summary == NULL) {
+		summary = calloc(1, sizeof(SpanSummary));
+
+		if (summary == NULL || hash_table_insert(&state->summaries, key, summary) < 0) {
+			free(summary);
+
+			return;
+		}
+
+		summary->uid = header->uid;
+		summary->function_id = header->function_id;
+		summary->min_latency = UINT64_MAX;
+	}
+
+	if (bucket >= PACKET_TRACE_SPAN_HISTOGRAM_SIZE) {
+		bucket = PACKET_TRACE_SPAN_HISTOGRAM_SIZE - 1;
+	}
+
+	++summary->count;
+	++summary->histogram[bucket];
+	summary->total_latency += latency;
+
+	if (latency < summary->min_latency) {
+		summary->min_latency = latency;
+	}
+
+	if (latency > summary->max_latency) {
+		summary->max_latency = latency;
+	}
+}
+
+// pairs records the same way as packet_trace.c does
+static void collect_span(TraceFile *file, const PacketTraceRecord *record, void *opaque) {
+	SpanState *state = opaque;
+	uint64_t key = ((uint64_t)record->header.uid << 12) |
+	               ((uint64_t)record->header.function_id << 4) |
+	               ((record->header.sequence_number_and_options >> 4) & 0x0F);
+	bool response = (record->trace_id & 1) != 0;
+	SpanKey *span_key;
+	int i;
+
+	(void)file;
+
+	if (record->trace_id == 0 ||
+	    (!response && (record->header.sequence_number_and_options & 0x08) == 0)) {
+		return;
+	}
+
+	span_key = hash_table_get(&state->keys, key);
+
+	if (span_key == NULL) {
+		if (response) {
+			return;
+		}
+
+		span_key = calloc(1, sizeof(SpanKey));
+
+		if (span_key == NULL || hash_table_insert(&state->keys, key, span_key) < 0) {
+			free(span_key);
+
+			return;
+		}
+	}
+
+	if (response) {
+		if (record->trace_id == span_key->last_response_trace_id ||
+		    span_key->pending_count == 0) {
+			return;
+		}
+
+		span_key->last_response_trace_id = record->trace_id;
+
+		add_latency(state, &record->header, record->timestamp - span_key->pending_timestamps[0]);
+		pop_pending(span_key);
+
+		return;
+	}
+
+	for (i = 0; i < span_key->pending_count; ++i) {
+		if (span_key->pending_trace_ids[i] == record->trace_id) {
+			return;
+		}
+	}
+
+	if (span_key->pending_count == SPAN_MAX_PENDING) {
+		pop_pending(span_key);
+	}
+
+	span_key->pending_trace_ids[span_key->pending_count] = record->trace_id;
+	span_key->pending_timestamps[span_key->pending_count] = record->timestamp;
+
+	++span_key->pending_count;
+}
+
+// returns the upper bound of the histogram bucket that contains PERCENTILE,
+// but not more than the maximum latency
+static uint64_t get_percentile(SpanSummary *summary, int percentile) {
+	uint64_t rank = (summary->count * (uint64_t)percentile + 99) / 100;
+	uint64_t sum = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < PACKET_TRACE_SPAN_HISTOGRAM_SIZE - 1; ++bucket) {
+		sum += summary->histogram[bucket];
+
+		if (sum >= rank) {
+			break;
+		}
+	}
+
+	if ((UINT64_C(1) << bucket) > summary->max_latency) {
+		return summary->max_latency;
+	}
+
+	return UINT64_C(1) << bucket;
+}
+
+static void print_summary(TraceFile *file, const Query *query) {
+	SpanState state;
+	SpanSummary *summary;
+	int i;
+	char base58[BASE58_MAX_LENGTH];
+
+	if (hash_table_create(&state.keys, 256) < 0) {
+		fprintf(stderr, "Could not create span key table: %s\n", strerror(errno));
+
+		return;
+	}
+
+	if (hash_table_create(&state.summaries, 64) < 0) {
+		fprintf(stderr, "Could not create span summary table: %s\n", strerror(errno));
+		hash_table_destroy(&state.keys, free);
+
+		return;
+	}
+
+	trace_file_query(file, query, collect_span, &state);
+
+	printf("%-8s %4s %10s %10s %10s %10s %10s %10s\n",
+	       "UID", "FID", "count", "min", "avg", "p50<=", "p99<=", "max");
+
+	for (i = 0; i < state.summaries.allocated; ++i) {
+		summary = state.summaries.buckets[i].value;
+
+		if (summary == NULL) {
+			continue;
+		}
+
+		printf("%-8s %4u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		       base58_encode(base58, uint32_from_le(summary->uid)), summary->function_id,
+		       summary->count, summary->min_latency,
+		       summary->total_latency / summary->count,
+		       get_percentile(summary, 50), get_percentile(summary, 99),
+		       summary->max_latency);
+	}
+
+	hash_table_destroy(&state.keys, free);
+	hash_table_destroy(&state.summaries, free);
+}
+
+static void print_info(TraceFile *file) {
+	uint64_t min_timestamp = UINT64_MAX;
+	uint64_t max_timestamp = 0;
+	uint64_t i;
+
+	for (i = 0; i < file->index_count; ++i) {
+		if (file->index[i].min_timestamp < min_timestamp) {
+			min_timestamp = file->index[i].min_timestamp;
+		}
+
+		if (file->index[i].max_timestamp > max_timestamp) {
+			max_timestamp = file->index[i].max_timestamp;
+		}
+	}
+
+	printf("version:  %u\n", file->header->version);
+	printf("records:  %" PRIu64 "\n", file->record_count);
+	printf("dropped:  %" PRIu64 "\n", file->header->dropped_count);
+	printf("blocks:   %" PRIu64 "%s\n", file->index_count,
+	       file->index_allocated ? " (index rebuilt)" : "");
+
+	if (file->record_count > 0) {
+		printf("first:    %" PRIu64 " usec\n", min_timestamp);
+		printf("last:     %" PRIu64 " usec\n", max_timestamp);
+		printf("duration: %" PRIu64 " usec\n", max_timestamp - min_timestamp);
+	}
+}
+
+static void print_usage(const char *name) {
+	fprintf(stderr, "usage: %s <file> info\n"
+	                "       %s <file> records [--from <usec>] [--to <usec>] [--trace-id <id>]\n"
+	                "       %s <file> summary [--from <usec>] [--to <usec>]\n",
+	        name, name, name);
+}
+
+int main(int argc, char **argv) {
+	TraceFile file;
+	Query query;
+	uint64_t last_timestamp = 0;
+	int i;
+
+	if (argc < 3) {
+		print_usage(argv[0]);
+
+		return 1;
+	}
+
+	query.from = 0;
+	query.to = UINT64_MAX;
+	query.trace_id = 0;
+
+	for (i = 3; i < argc; ++i) {
+		if (i + 1 >= argc) {
+			print_usage(argv[0]);
+
+			return 1;
+		}
+
+		if (strcmp(argv[i], "--from") == 0) {
+			query.from = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--to") == 0) {
+			query.to = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--trace-id") == 0) {
+			query.trace_id = strtoull(argv[++i], NULL, 0);
+		} else {
+			print_usage(argv[0]);
+
+			return 1;
+		}
+	}
+
+	if (trace_file_open(&file, argv[1]) < 0) {
+		return 1;
+	}
+
+	if (strcmp(argv[2], "info") == 0) {
+		print_info(&file);
+	} else if (strcmp(argv[2], "records") == 0) {
+		trace_file_query(&file, &query, print_record, &last_timestamp);
+	} else if (strcmp(argv[2], "summary") == 0) {
+		print_summary(&file, &query);
+	} else {
+		print_usage(argv[0]);
+		trace_file_close(&file);
+
+		return 1;
+	}
+
+	trace_file_close(&file);
+
+	return 0;
+}
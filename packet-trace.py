@@ -20,30 +20,57 @@ def base58encode(value):
 
     return BASE58[value] + encoded
 
+MAGIC = b'DLPTRACE'
+VERSION = 2
+
+HEADER_FORMAT = '<8sIIIIIIQQQQQQ'
+RECORD_FORMAT = '<QQIBBBBIi'
+
+UNKNOWN_FILENAME_ID = 0xFFFFFFFF
+
 def main():
     path = sys.argv[1]
 
     with open(path, 'rb') as f:
         data = f.read()
 
-    last_timestamp = None
+    if len(data) < struct.calcsize(HEADER_FORMAT):
+        print('{} is not a packet trace file (version {})'.format(path, VERSION))
+        sys.exit(1)
+
+    magic, version, header_length, record_length, block_record_count, \
+        string_count, string_length, string_table_offset, record_offset, \
+        record_count, dropped, index_offset, index_count = \
+        struct.unpack_from(HEADER_FORMAT, data, 0)
 
-    while len(data) > 0:
-        trace_id, timestamp, header_uid, header_length, header_function_id, \
-          header_sequence_number_and_options, header_error_code_and_future_use \
-          = struct.unpack_from('<QQIBBBB', data, 0)
+    if magic != MAGIC or version != VERSION or record_length != struct.calcsize(RECORD_FORMAT):
+        print('{} is not a packet trace file (version {})'.format(path, VERSION))
+        sys.exit(1)
 
-        data = data[24:]
+    filenames = {UNKNOWN_FILENAME_ID: '<unknown>'}
 
-        i = data.find(b'\0')
-        filename = data[:i].decode('utf-8')
+    for filename_id in range(string_count):
+        offset = string_table_offset + filename_id * string_length
+        filename = data[offset:offset + string_length].split(b'\0', 1)[0]
 
-        data = data[i + 1:]
+        if len(filename) > 0:
+            filenames[filename_id] = filename.decode('utf-8', 'replace')
 
-        line = struct.unpack_from('<i', data, 0)[0]
+    # the file might have been cut short if the program didn't exit normally
+    record_count = min(record_count, (len(data) - record_offset) // record_length)
+    records = []
 
-        data = data[4:]
+    for i in range(record_count):
+        records.append(struct.unpack_from(RECORD_FORMAT, data, record_offset + i * record_length))
 
+    # records of different threads might be slightly out of order
+    records.sort(key=lambda record: record[1])
+
+    last_timestamp = None
+
+    for trace_id, timestamp, header_uid, header_length, header_function_id, \
+        header_sequence_number_and_options, header_error_code_and_future_use, \
+        filename_id, line in records:
         if last_timestamp == None:
             last_timestamp = timestamp
 
@@ -55,12 +82,15 @@ def main():
                       header_length,
                       header_function_id,
                       header_sequence_number_and_options >> 4,
-                      (header_sequence_number_and_options >> 2) & 1,
+                      (header_sequence_number_and_options >> 3) & 1,
                       header_error_code_and_future_use >> 6,
-                      filename,
+                      filenames.get(filename_id, '<{}>'.format(filename_id)),
                       line))
 
         last_timestamp = timestamp
 
+    if dropped > 0:
+        print('{} record(s) were dropped'.format(dropped))
+
 if __name__ == '__main__':
     main()
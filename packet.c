@@ -34,14 +34,9 @@
 #include "base58.h"
 #include "log.h"
 #include "macros.h"
+#include "packet_trace.h"
 #include "utils.h"
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-
-static LogSource _log_source = LOG_SOURCE_INITIALIZER;
-
-#endif
-
 STATIC_ASSERT(sizeof(PacketHeader) == 8, "PacketHeader has invalid size")
 STATIC_ASSERT(sizeof(Packet) == 80, "Packet has invalid size")
 STATIC_ASSERT(sizeof(EnumerateCallback) == 34, "EnumerateCallback has invalid size")
@@ -53,20 +48,8 @@ STATIC_ASSERT(sizeof(StackEnumerateResponse) == 72, "StackEnumerateResponse has
 
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
 
-#define TRACE_BUFFER_SIZE 1000
-
-typedef struct {
-	uint64_t trace_id;
-	uint64_t timestamp; // microseconds
-	PacketHeader header;
-	const char *filename; // __FILE__
-	int line; // __LINE__
-} PacketTrace;
-
 static uint64_t _next_request_trace_id = 2; // start even
 static uint64_t _next_response_trace_id = UINT64_MAX; // start odd and high
-static PacketTrace _trace_buffer[TRACE_BUFFER_SIZE];
-static int _trace_buffer_used = 0;
 
 #endif
 
@@ -305,45 +288,9 @@ uint64_t packet_get_next_response_trace_id(void) {
 	return __sync_fetch_and_sub(&_next_response_trace_id, 2); // keep even
 }
 
+// see packet_trace.c
 void packet_add_trace_(Packet *packet, const char *filename, int line) {
-	PacketTrace *trace = &_trace_buffer[_trace_buffer_used++];
-	FILE *fp;
-	int i;
-
-	trace->trace_id = packet->trace_id;
-	trace->timestamp = microtime();
-	trace->header = packet->header;
-	trace->filename = filename;
-	trace->line = line;
-
-	if (_trace_buffer_used == TRACE_BUFFER_SIZE) {
-		log_info("Writing packet trace to /tmp/daemonlib-packet-trace");
-
-		fp = fopen("/tmp/daemonlib-packet-trace", "wb");
-
-		if (fp == NULL) {
-			_trace_buffer_used = 0;
-
-			log_error("Could not open /tmp/daemonlib-packet-trace");
-
-			return;
-		}
-
-		for (i = 0; i < _trace_buffer_used; ++i) {
-			trace = &_trace_buffer[i];
-
-			fwrite(&trace->trace_id, 1, sizeof(trace->trace_id), fp);
-			fwrite(&trace->timestamp, 1, sizeof(trace->timestamp), fp);
-			fwrite(&trace->header, 1, sizeof(trace->header), fp);
-			fwrite(trace->filename, 1, strlen(trace->filename) + 1, fp);
-			fwrite(&trace->line, 1, sizeof(trace->line), fp);
-		}
-
-		fflush(fp);
-		fclose(fp);
-
-		_trace_buffer_used = 0;
-	}
+	packet_trace_add(packet->trace_id, &packet->header, filename, line);
 }
 
 #endif
@@ -0,0 +1,206 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_pool.c: Pooled packet allocator specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the packet pool allocates SharedPacket objects with room for a full packet
+ * from a Slab object, so each one starts on its own cache line and no call to
+ * malloc and free is needed per packet. the Slab object is shared by all
+ * threads and protected by a mutex. to avoid taking the mutex for each packet
+ * every thread keeps a small cache of free objects, that is refilled from and
+ * flushed to the Slab object in batches of half its size.
+ *
+ * an object can be freed by a different thread than the one that allocated
+ * it. it then ends up in the cache of the freeing thread. objects in the cache
+ * of a thread that exits are not returned to the Slab object, but their memory
+ * is still freed by packet_pool_exit.
+ *
+ * packet_pool_init and packet_pool_exit have to be called while no other
+ * thread uses the pool and all objects have to be freed before calling
+ * packet_pool_exit.
+ *
+ * currently only SharedPacket objects, as used by the write backlogs for
+ * broadcast packets, are allocated from the pool. the PacketReader buffer,
+ * the queues and the packet trace rings still hold packets by value.
+ * packet-pool-bench.c measures the allocation rate and copy volume of both
+ * approaches.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "packet_pool.h"
+
+#include "log.h"
+#include "macros.h"
+#include "slab.h"
+#include "threads.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	int generation; // of the pool the cached objects belong to
+	int count;
+	void *free_list; // linked through the first bytes of the objects
+} PacketPoolCache;
+
+static bool _initialized = false;
+static int _generation = 0; // incremented by each packet_pool_init call
+static Mutex _mutex; // protects _slab
+static Slab _slab; // SharedPacket
+static THREAD_LOCAL PacketPoolCache _cache = { 0, 0, NULL };
+
+static void packet_pool_check_cache(void) {
+	// the cache still holds objects of a previous pool, forget them because
+	// their memory has already been freed by packet_pool_exit
+	if (_cache.generation != _generation) {
+		_cache.generation = _generation;
+		_cache.count = 0;
+		_cache.free_list = NULL;
+	}
+}
+
+static void packet_pool_push_cache(void *object) {
+	*(void **)object = _cache.free_list;
+	_cache.free_list = object;
+
+	++_cache.count;
+}
+
+static void *packet_pool_pop_cache(void) {
+	void *object = _cache.free_list;
+
+	_cache.free_list = *(void **)object;
+
+	--_cache.count;
+
+	return object;
+}
+
+// moves up to half a cache of objects from the Slab object to the cache
+static void packet_pool_refill_cache(void) {
+	void *object;
+
+	mutex_lock(&_mutex);
+
+	while (_cache.count < PACKET_POOL_CACHE_SIZE / 2) {
+		object = slab_alloc(&_slab);
+
+		if (object == NULL) {
+			break;
+		}
+
+		packet_pool_push_cache(object);
+	}
+
+	mutex_unlock(&_mutex);
+}
+
+// moves half a cache of objects from the cache back to the Slab object
+static void packet_pool_flush_cache(void) {
+	mutex_lock(&_mutex);
+
+	while (_cache.count > PACKET_POOL_CACHE_SIZE / 2) {
+		slab_free(&_slab, packet_pool_pop_cache());
+	}
+
+	mutex_unlock(&_mutex);
+}
+
+int packet_pool_init(void) {
+	log_debug("Initializing packet pool subsystem");
+
+	if (slab_create(&_slab, sizeof(SharedPacket), PACKET_POOL_CHUNK_COUNT) < 0) {
+		log_error("Could not create packet pool slab: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	mutex_create(&_mutex);
+
+	++_generation;
+	_initialized = true;
+
+	return 0;
+}
+
+void packet_pool_exit(void) {
+	log_debug("Shutting down packet pool subsystem");
+
+	_initialized = false;
+
+	mutex_destroy(&_mutex);
+	slab_destroy(&_slab);
+}
+
+bool packet_pool_is_initialized(void) {
+	return _initialized;
+}
+
+// allocates a SharedPacket object with room for a full packet and a reference
+// count of 1. only the reference count is initialized, the packet is not.
+//
+// returns NULL on error (sets errno) or the new SharedPacket object on success
+SharedPacket *packet_pool_alloc(void) {
+	SharedPacket *shared_packet;
+
+	packet_pool_check_cache();
+
+	if (_cache.free_list == NULL) {
+		packet_pool_refill_cache();
+
+		if (_cache.free_list == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+	}
+
+	shared_packet = packet_pool_pop_cache();
+
+	shared_packet->ref_count = 1;
+	shared_packet->pooled = true;
+
+	return shared_packet;
+}
+
+// returns SHARED_PACKET to the pool, regardless of its reference count
+void packet_pool_free(SharedPacket *shared_packet) {
+	packet_pool_check_cache();
+	packet_pool_push_cache(shared_packet);
+
+	if (_cache.count > PACKET_POOL_CACHE_SIZE) {
+		packet_pool_flush_cache();
+	}
+}
+
+// returns the number of objects that are allocated or held by thread caches
+int packet_pool_get_count(void) {
+	int count;
+
+	mutex_lock(&_mutex);
+
+	count = _slab.count;
+
+	mutex_unlock(&_mutex);
+
+	return count;
+}
@@ -0,0 +1,42 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_pool.h: Pooled packet allocator specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PACKET_POOL_H
+#define DAEMONLIB_PACKET_POOL_H
+
+#include <stdbool.h>
+
+#include "shared_packet.h"
+
+#define PACKET_POOL_CHUNK_COUNT 256 // objects allocated from the system at once
+#define PACKET_POOL_CACHE_SIZE 64 // objects kept per thread
+
+int packet_pool_init(void);
+void packet_pool_exit(void);
+
+bool packet_pool_is_initialized(void);
+
+SharedPacket *packet_pool_alloc(void);
+void packet_pool_free(SharedPacket *shared_packet);
+
+int packet_pool_get_count(void);
+
+#endif // DAEMONLIB_PACKET_POOL_H
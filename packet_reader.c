@@ -0,0 +1,148 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.c: Incremental packet reader specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a PacketReader object reassembles packets from a byte stream. instead of
+ * reading each packet with its own read call it reads as many bytes as fit
+ * into its buffer at once. all complete packets in the newly read bytes are
+ * validated in one go and then handed out one by one without copying them.
+ * the buffer is only compacted if the incomplete packet at its end might not
+ * fit into the remaining space.
+ *
+ * usage from a read event handler:
+ *
+ *   if (packet_reader_read(&reader) <= 0) {
+ *       // handle error (check errno), IO_CONTINUE or end-of-file
+ *   }
+ *
+ *   while ((packet = packet_reader_next(&reader, &message)) != NULL) {
+ *       // handle packet
+ *   }
+ *
+ *   if (message != NULL) {
+ *       // handle invalid packet
+ *   }
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "packet_reader.h"
+
+// creates a PacketReader object that reads from IO and validates the headers
+// of the read packets with VALIDATE
+void packet_reader_create(PacketReader *reader, IO *io,
+                          PacketReaderValidateFunction validate) {
+	reader->io = io;
+	reader->validate = validate;
+	reader->start = 0;
+	reader->complete = 0;
+	reader->end = 0;
+	reader->invalid_message = NULL;
+}
+
+// reads as many bytes as possible with a single read call. all packets that
+// were returned by packet_reader_next before become invalid. if the stream
+// contains an invalid packet header then no more bytes are read, because the
+// packet boundaries cannot be determined anymore.
+//
+// returns -1 on error (sets errno), IO_CONTINUE if the IO object needs more
+// data or if the buffer is full because buffered packets were not handed out
+// yet, 0 on end-of-file or the number of read bytes
+int packet_reader_read(PacketReader *reader) {
+	PacketHeader *header;
+	int rc;
+
+	if (reader->invalid_message != NULL) {
+		errno = EPROTO;
+
+		return -1;
+	}
+
+	if (reader->start == reader->end) {
+		// everything was handed out, start over at the beginning
+		reader->start = 0;
+		reader->complete = 0;
+		reader->end = 0;
+	} else if (reader->end + (int)sizeof(Packet) > PACKET_READER_BUFFER_SIZE) {
+		// the packet at the end might not fit anymore, move it to the beginning
+		memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+
+		reader->complete -= reader->start;
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+
+	if (reader->end == PACKET_READER_BUFFER_SIZE) {
+		// the buffer is full of packets that were not handed out yet, reading
+		// zero bytes would be mistaken for end-of-file
+		return IO_CONTINUE;
+	}
+
+	rc = io_read(reader->io, reader->buffer + reader->end,
+	             PACKET_READER_BUFFER_SIZE - reader->end);
+
+	if (rc <= 0) {
+		return rc;
+	}
+
+	reader->end += rc;
+
+	// validate all new complete packets
+	while (reader->end - reader->complete >= (int)sizeof(PacketHeader)) {
+		header = (PacketHeader *)(reader->buffer + reader->complete);
+
+		if (!reader->validate(header, &reader->invalid_message)) {
+			break;
+		}
+
+		if (header->length > reader->end - reader->complete) {
+			break;
+		}
+
+		reader->complete += header->length;
+	}
+
+	return rc;
+}
+
+// returns the next validated complete packet or NULL if there is none. the
+// packet stays valid until the next call to packet_reader_read. if NULL is
+// returned and MESSAGE is not NULL then MESSAGE is set to NULL if no more
+// complete packets are buffered or to a description of the problem if the
+// next packet header is invalid
+Packet *packet_reader_next(PacketReader *reader, const char **message) {
+	Packet *packet;
+
+	if (reader->start == reader->complete) {
+		if (message != NULL) {
+			*message = reader->invalid_message;
+		}
+
+		return NULL;
+	}
+
+	packet = (Packet *)(reader->buffer + reader->start);
+
+	reader->start += packet->header.length;
+
+	return packet;
+}
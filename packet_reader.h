@@ -0,0 +1,52 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_reader.h: Incremental packet reader specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PACKET_READER_H
+#define DAEMONLIB_PACKET_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "io.h"
+#include "packet.h"
+
+#define PACKET_READER_BUFFER_SIZE ((int)sizeof(Packet) * 64)
+
+// packet_header_is_valid_request and packet_header_is_valid_response
+typedef bool (*PacketReaderValidateFunction)(PacketHeader *header, const char **message);
+
+typedef struct {
+	IO *io;
+	PacketReaderValidateFunction validate;
+	int start; // offset of the first packet not handed out yet
+	int complete; // offset behind the last validated complete packet
+	int end; // offset behind the last read byte
+	const char *invalid_message; // set if the header at COMPLETE is invalid
+	uint8_t buffer[PACKET_READER_BUFFER_SIZE];
+} PacketReader;
+
+void packet_reader_create(PacketReader *reader, IO *io,
+                          PacketReaderValidateFunction validate);
+
+int packet_reader_read(PacketReader *reader);
+Packet *packet_reader_next(PacketReader *reader, const char **message);
+
+#endif // DAEMONLIB_PACKET_READER_H
@@ -0,0 +1,849 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_trace.c: Packet trace recording specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * packet trace records are collected without locks and without blocking the
+ * thread that handles the packet. each thread that adds trace records gets
+ * its own single-producer/single-consumer ring. a background thread drains
+ * all rings periodically, sorts the collected records by their timestamp and
+ * appends them to a memory-mapped trace file that is grown in chunks. if a
+ * ring is full the record is dropped and counted, instead of waiting for the
+ * background thread. see packet_trace.h for the file format.
+ *
+ * filenames are given as __FILE__ string literals, which stay valid for the
+ * lifetime of the program. they are interned by their address into a fixed
+ * size table, the records only store the index into this table. the table
+ * index is also the index into the string table of the trace file, the name
+ * of a filename is written there before its first use.
+ *
+ * the rings of threads that exit are kept, because the background thread
+ * might still be draining them. the background thread is started with the
+ * first trace record and stopped at program exit.
+ *
+ * the background thread also pairs requests and responses to spans. a
+ * response matches the oldest pending request with the same UID, function ID
+ * and sequence number. only the first trace point of each request and each
+ * response is used, so the span covers the time from the request entering the
+ * daemon until its response entering the daemon. the records of all rings of
+ * a drain pass are sorted by their timestamp before pairing, because a
+ * request and its response might be traced by different threads. the span
+ * latencies are collected in histograms per UID and function ID, that can be
+ * logged with packet_trace_dump_spans at any time.
+ */
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "packet_trace.h"
+
+#include "array.h"
+#include "base58.h"
+#include "hash_table.h"
+#include "log.h"
+#include "macros.h"
+#include "node.h"
+#include "slab.h"
+#include "threads.h"
+#include "utils.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define RING_SIZE 4096 // records, power of two
+#define RING_MASK (RING_SIZE - 1)
+#define FILENAME_TABLE_SIZE PACKET_TRACE_STRING_COUNT // power of two
+#define FILENAME_TABLE_MASK (FILENAME_TABLE_SIZE - 1)
+#define FLUSH_INTERVAL 100 // milliseconds
+#define FILE_GROWTH (1024 * 1024) // bytes
+#define SPAN_MAX_PENDING 4 // requests per span key
+#define SPAN_TIMEOUT 10000000 // microseconds
+
+typedef struct _PacketTraceRing PacketTraceRing;
+
+struct _PacketTraceRing {
+	PacketTraceRing *next;
+	uint32_t read_index; // only written by the background thread
+	uint32_t write_index; // only written by the owning thread
+	uint32_t dropped; // records dropped since the last drain
+	PacketTraceRecord records[RING_SIZE];
+};
+
+static PacketTraceRing *_rings = NULL; // LIFO
+static THREAD_LOCAL PacketTraceRing *_ring = NULL;
+static const char *_filenames[FILENAME_TABLE_SIZE];
+static bool _started = false;
+static bool _running = false;
+static Thread _thread;
+
+typedef struct {
+	Node node; // see _span_key_sentinel
+	uint64_t key; // (uid, function_id, sequence_number)
+	uint64_t last_used; // in microseconds
+	uint64_t last_response_trace_id;
+	int pending_count;
+	uint64_t pending_trace_ids[SPAN_MAX_PENDING]; // oldest first
+	uint64_t pending_timestamps[SPAN_MAX_PENDING]; // in microseconds
+} PacketTraceSpanKey;
+
+// only used by the background thread
+static bool _filename_written[FILENAME_TABLE_SIZE];
+static int _fd = -1;
+static uint8_t *_mapping = NULL;
+static size_t _mapping_size = 0;
+static size_t _file_size = 0; // bytes used in the mapping
+static Array _records; // PacketTraceRecord, of the current drain pass
+static Array _index; // PacketTraceIndexEntry
+static PacketTraceIndexEntry _index_entry; // of the current block
+static Slab _span_key_slab; // PacketTraceSpanKey
+static HashTable _span_keys; // (uid, function_id, sequence_number) -> PacketTraceSpanKey
+static Node _span_key_sentinel; // PacketTraceSpanKey.node, least recently used first
+
+// shared between the background thread and packet_trace_dump_spans
+static bool _spans_enabled = false; // set after _span_mutex was created
+static Mutex _span_mutex;
+static Array _span_statistics; // PacketTraceSpanStatistics
+static HashTable _span_statistics_index; // (uid, function_id) -> PacketTraceSpanStatistics
+
+// returns the index of FILENAME in the filename table, adds it if necessary
+static uint32_t packet_trace_intern_filename(const char *filename) {
+	uint32_t i = (uint32_t)(((uintptr_t)filename >> 3) * 2654435761u) & FILENAME_TABLE_MASK;
+	const char *current;
+	int k;
+
+	for (k = 0; k < FILENAME_TABLE_SIZE; ++k) {
+		current = __atomic_load_n(&_filenames[i], __ATOMIC_ACQUIRE);
+
+		if (current == NULL) {
+			if (__sync_bool_compare_and_swap(&_filenames[i], NULL, filename)) {
+				return i;
+			}
+
+			// another thread just used this slot, maybe for the same filename
+			current = __atomic_load_n(&_filenames[i], __ATOMIC_ACQUIRE);
+		}
+
+		if (current == filename) {
+			return i;
+		}
+
+		i = (i + 1) & FILENAME_TABLE_MASK;
+	}
+
+	return PACKET_TRACE_UNKNOWN_FILENAME_ID;
+}
+
+// returns -1 on error (sets errno) or 0 on success
+static int packet_trace_reserve(size_t length) {
+	size_t mapping_size = _mapping_size;
+
+	if (_file_size + length <= _mapping_size) {
+		return 0;
+	}
+
+	while (_file_size + length > mapping_size) {
+		mapping_size += FILE_GROWTH;
+	}
+
+	if (_mapping != NULL) {
+		munmap(_mapping, _mapping_size);
+
+		_mapping = NULL;
+		_mapping_size = 0;
+	}
+
+	if (ftruncate(_fd, (off_t)mapping_size) < 0) {
+		return -1;
+	}
+
+	_mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+	if (_mapping == MAP_FAILED) {
+		_mapping = NULL;
+
+		return -1;
+	}
+
+	_mapping_size = mapping_size;
+
+	return 0;
+}
+
+static void packet_trace_append(const void *buffer, size_t length) {
+	memcpy(_mapping + _file_size, buffer, length);
+
+	_file_size += length;
+}
+
+static PacketTraceFileHeader *packet_trace_get_header(void) {
+	return (PacketTraceFileHeader *)_mapping;
+}
+
+static void packet_trace_stop_writing(void) {
+	log_error("Could not grow packet trace file %s, stopping packet trace: %s (%d)",
+	          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+
+	if (_mapping != NULL) {
+		munmap(_mapping, _mapping_size);
+
+		_mapping = NULL;
+	}
+
+	robust_close(_fd);
+
+	_fd = -1;
+}
+
+static void packet_trace_write_filename(uint32_t id) {
+	const char *name = __atomic_load_n(&_filenames[id], __ATOMIC_ACQUIRE);
+	int length = (int)strlen(name);
+	PacketTraceFileHeader *header = packet_trace_get_header();
+
+	// keep the end of overlong filenames, it is more specific
+	if (length > PACKET_TRACE_STRING_LENGTH - 1) {
+		name += length - (PACKET_TRACE_STRING_LENGTH - 1);
+		length = PACKET_TRACE_STRING_LENGTH - 1;
+	}
+
+	memcpy(_mapping + header->string_table_offset + id * PACKET_TRACE_STRING_LENGTH,
+	       name, length);
+
+	_filename_written[id] = true;
+}
+
+static void packet_trace_write_record(PacketTraceRecord *record) {
+	PacketTraceFileHeader *header;
+	PacketTraceIndexEntry *index_entry;
+
+	if (_fd < 0) {
+		return;
+	}
+
+	if (packet_trace_reserve(sizeof(*record)) < 0) {
+		packet_trace_stop_writing();
+
+		return;
+	}
+
+	header = packet_trace_get_header();
+
+	if (record->filename_id != PACKET_TRACE_UNKNOWN_FILENAME_ID &&
+	    !_filename_written[record->filename_id]) {
+		packet_trace_write_filename(record->filename_id);
+	}
+
+	packet_trace_append(record, sizeof(*record));
+
+	if (header->record_count % PACKET_TRACE_BLOCK_RECORD_COUNT == 0) {
+		memset(&_index_entry, 0, sizeof(_index_entry));
+
+		_index_entry.first_record = header->record_count;
+		_index_entry.min_timestamp = UINT64_MAX;
+	}
+
+	++header->record_count;
+
+	if (record->timestamp < _index_entry.min_timestamp) {
+		_index_entry.min_timestamp = record->timestamp;
+	}
+
+	if (record->timestamp > _index_entry.max_timestamp) {
+		_index_entry.max_timestamp = record->timestamp;
+	}
+
+	if (record->trace_id == 0) {
+		// invalid trace ID, not indexed
+	} else if ((record->trace_id & 1) == 0) {
+		if (_index_entry.min_request_trace_id == 0 || record->trace_id < _index_entry.min_request_trace_id) {
+			_index_entry.min_request_trace_id = record->trace_id;
+		}
+
+		if (record->trace_id > _index_entry.max_request_trace_id) {
+			_index_entry.max_request_trace_id = record->trace_id;
+		}
+	} else {
+		if (_index_entry.min_response_trace_id == 0 || record->trace_id < _index_entry.min_response_trace_id) {
+			_index_entry.min_response_trace_id = record->trace_id;
+		}
+
+		if (record->trace_id > _index_entry.max_response_trace_id) {
+			_index_entry.max_response_trace_id = record->trace_id;
+		}
+	}
+
+	if (header->record_count % PACKET_TRACE_BLOCK_RECORD_COUNT == 0) {
+		index_entry = array_append(&_index);
+
+		if (index_entry != NULL) {
+			*index_entry = _index_entry;
+		}
+	}
+}
+
+static int packet_trace_get_latency_bucket(uint64_t latency) {
+	int bucket = latency == 0 ? 0 : 64 - __builtin_clzll(latency);
+
+	if (bucket >= PACKET_TRACE_SPAN_HISTOGRAM_SIZE) {
+		bucket = PACKET_TRACE_SPAN_HISTOGRAM_SIZE - 1;
+	}
+
+	return bucket;
+}
+
+static int packet_trace_compare_records(const void *a, const void *b) {
+	uint64_t timestamp_a = ((const PacketTraceRecord *)a)->timestamp;
+	uint64_t timestamp_b = ((const PacketTraceRecord *)b)->timestamp;
+
+	return timestamp_a < timestamp_b ? -1 : (timestamp_a > timestamp_b ? 1 : 0);
+}
+
+// returns -1 on error (sets errno) or 0 on success
+static int packet_trace_create_spans(void) {
+	int phase = 0;
+
+	node_reset(&_span_key_sentinel);
+
+	phase = 1;
+
+	if (slab_create(&_span_key_slab, sizeof(PacketTraceSpanKey), 64) < 0) {
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (hash_table_create(&_span_keys, 64) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (array_create(&_span_statistics, 16, sizeof(PacketTraceSpanStatistics), false) < 0) {
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (hash_table_create(&_span_statistics_index, 16) < 0) {
+		goto cleanup;
+	}
+
+	// create the mutex last, so the error path doesn't need to destroy it
+	mutex_create(&_span_mutex);
+
+	phase = 5;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		array_destroy(&_span_statistics, NULL);
+		// fall through
+
+	case 3:
+		hash_table_destroy(&_span_keys, NULL);
+		// fall through
+
+	case 2:
+		slab_destroy(&_span_key_slab);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 5 ? 0 : -1;
+}
+
+static void packet_trace_destroy_spans(void) {
+	mutex_lock(&_span_mutex);
+
+	__atomic_store_n(&_spans_enabled, false, __ATOMIC_RELEASE);
+
+	hash_table_destroy(&_span_statistics_index, NULL);
+	array_destroy(&_span_statistics, NULL);
+
+	mutex_unlock(&_span_mutex);
+
+	hash_table_destroy(&_span_keys, NULL);
+	slab_destroy(&_span_key_slab);
+}
+
+static void packet_trace_record_span(PacketHeader *header, uint64_t latency) {
+	uint64_t key = ((uint64_t)header->uid << 8) | header->function_id;
+	PacketTraceSpanStatistics *statistics;
+	int bucket = packet_trace_get_latency_bucket(latency);
+
+	mutex_lock(&_span_mutex);
+
+	statistics = hash_table_get(&_span_statistics_index, key);
+
+	if (statistics == NULL) {
+		statistics = array_append(&_span_statistics);
+
+		if (statistics == NULL) {
+			mutex_unlock(&_span_mutex);
+
+			return;
+		}
+
+		if (hash_table_insert(&_span_statistics_index, key, statistics) < 0) {
+			array_remove(&_span_statistics, _span_statistics.count - 1, NULL);
+			mutex_unlock(&_span_mutex);
+
+			return;
+		}
+
+		statistics->uid = header->uid;
+		statistics->function_id = header->function_id;
+		statistics->min_latency = UINT64_MAX;
+	}
+
+	++statistics->count;
+	++statistics->histogram[bucket];
+	statistics->total_latency += latency;
+
+	if (latency < statistics->min_latency) {
+		statistics->min_latency = latency;
+	}
+
+	if (latency > statistics->max_latency) {
+		statistics->max_latency = latency;
+	}
+
+	mutex_unlock(&_span_mutex);
+}
+
+static void packet_trace_pop_pending_span(PacketTraceSpanKey *span_key) {
+	--span_key->pending_count;
+
+	memmove(span_key->pending_trace_ids, span_key->pending_trace_ids + 1,
+	        span_key->pending_count * sizeof(uint64_t));
+	memmove(span_key->pending_timestamps, span_key->pending_timestamps + 1,
+	        span_key->pending_count * sizeof(uint64_t));
+}
+
+static void packet_trace_handle_span_record(PacketTraceRecord *record) {
+	uint64_t key = ((uint64_t)record->header.uid << 12) |
+	               ((uint64_t)record->header.function_id << 4) |
+	               packet_header_get_sequence_number(&record->header);
+	PacketTraceSpanKey *span_key = hash_table_get(&_span_keys, key);
+	bool response = (record->trace_id & 1) != 0;
+	int i;
+
+	// requests without expected response never get a response
+	if (record->trace_id == 0 ||
+	    (!response && !packet_header_get_response_expected(&record->header))) {
+		return;
+	}
+
+	if (span_key == NULL) {
+		if (response) {
+			return; // no pending request
+		}
+
+		span_key = slab_alloc(&_span_key_slab);
+
+		if (span_key == NULL) {
+			return;
+		}
+
+		if (hash_table_insert(&_span_keys, key, span_key) < 0) {
+			slab_free(&_span_key_slab, span_key);
+
+			return;
+		}
+
+		span_key->key = key;
+	} else {
+		node_remove(&span_key->node);
+	}
+
+	// keep the span keys ordered by their last use
+	span_key->last_used = record->timestamp;
+
+	node_insert_before(&_span_key_sentinel, &span_key->node);
+
+	// drop requests that didn't get a response in time
+	while (span_key->pending_count > 0 &&
+	       span_key->pending_timestamps[0] + SPAN_TIMEOUT < record->timestamp) {
+		packet_trace_pop_pending_span(span_key);
+	}
+
+	if (response) {
+		// only the first trace point of a response ends the span
+		if (record->trace_id == span_key->last_response_trace_id ||
+		    span_key->pending_count == 0) {
+			return;
+		}
+
+		span_key->last_response_trace_id = record->trace_id;
+
+		packet_trace_record_span(&record->header, record->timestamp - span_key->pending_timestamps[0]);
+		packet_trace_pop_pending_span(span_key);
+
+		return;
+	}
+
+	// only the first trace point of a request starts the span
+	for (i = 0; i < span_key->pending_count; ++i) {
+		if (span_key->pending_trace_ids[i] == record->trace_id) {
+			return;
+		}
+	}
+
+	if (span_key->pending_count == SPAN_MAX_PENDING) {
+		packet_trace_pop_pending_span(span_key);
+	}
+
+	span_key->pending_trace_ids[span_key->pending_count] = record->trace_id;
+	span_key->pending_timestamps[span_key->pending_count] = record->timestamp;
+
+	++span_key->pending_count;
+}
+
+// forgets span keys that were not used for a while
+static void packet_trace_expire_span_keys(void) {
+	PacketTraceSpanKey *span_key;
+	uint64_t now = microtime();
+
+	while (_span_key_sentinel.next != &_span_key_sentinel) {
+		span_key = containerof(_span_key_sentinel.next, PacketTraceSpanKey, node);
+
+		if (span_key->last_used + SPAN_TIMEOUT >= now) {
+			break;
+		}
+
+		node_remove(&span_key->node);
+		hash_table_remove(&_span_keys, span_key->key);
+		slab_free(&_span_key_slab, span_key);
+	}
+}
+
+// moves all records from all rings to the trace file
+static void packet_trace_drain(void) {
+	PacketTraceRing *ring = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE);
+	PacketTraceRecord *record;
+	uint32_t read_index;
+	uint32_t write_index;
+	uint32_t dropped;
+	int i;
+
+	for (; ring != NULL; ring = ring->next) {
+		read_index = ring->read_index;
+		write_index = __atomic_load_n(&ring->write_index, __ATOMIC_ACQUIRE);
+		dropped = 0;
+
+		while (read_index != write_index) {
+			record = array_append(&_records);
+
+			if (record != NULL) {
+				*record = ring->records[read_index & RING_MASK];
+			} else {
+				++dropped;
+			}
+
+			++read_index;
+		}
+
+		__atomic_store_n(&ring->read_index, read_index, __ATOMIC_RELEASE);
+
+		dropped += __sync_fetch_and_and(&ring->dropped, 0);
+
+		if (dropped > 0) {
+			log_warn("Packet trace ring was full, dropped %u record(s)", dropped);
+
+			if (_fd >= 0) {
+				packet_trace_get_header()->dropped_count += dropped;
+			}
+		}
+	}
+
+	// records of different threads are interleaved in time
+	qsort(_records.bytes, _records.count, sizeof(PacketTraceRecord),
+	      packet_trace_compare_records);
+
+	for (i = 0; i < _records.count; ++i) {
+		record = array_get(&_records, i);
+
+		packet_trace_write_record(record);
+
+		if (_spans_enabled) {
+			packet_trace_handle_span_record(record);
+		}
+	}
+
+	array_resize(&_records, 0, NULL);
+
+	if (_spans_enabled) {
+		packet_trace_expire_span_keys();
+	}
+}
+
+static void packet_trace_open(void) {
+	PacketTraceFileHeader *header;
+	size_t string_table_length = PACKET_TRACE_STRING_COUNT * PACKET_TRACE_STRING_LENGTH;
+
+	log_info("Writing packet trace to %s", PACKET_TRACE_FILENAME);
+
+	_fd = open(PACKET_TRACE_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (_fd < 0) {
+		log_error("Could not open packet trace file %s: %s (%d)",
+		          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	if (packet_trace_reserve(sizeof(*header) + string_table_length) < 0) {
+		packet_trace_stop_writing();
+
+		return;
+	}
+
+	// the mapping is zero initialized, the string table starts out empty
+	header = packet_trace_get_header();
+
+	memcpy(header->magic, PACKET_TRACE_MAGIC, sizeof(header->magic));
+
+	header->version = PACKET_TRACE_VERSION;
+	header->header_length = sizeof(*header);
+	header->record_length = sizeof(PacketTraceRecord);
+	header->block_record_count = PACKET_TRACE_BLOCK_RECORD_COUNT;
+	header->string_count = PACKET_TRACE_STRING_COUNT;
+	header->string_length = PACKET_TRACE_STRING_LENGTH;
+	header->string_table_offset = sizeof(*header);
+	header->record_offset = sizeof(*header) + string_table_length;
+
+	_file_size = header->record_offset;
+}
+
+// appends the index and cuts the trace file to its used size
+static void packet_trace_close(void) {
+	PacketTraceFileHeader *header;
+	size_t index_length;
+
+	if (_fd < 0) {
+		return;
+	}
+
+	header = packet_trace_get_header();
+
+	// add the incomplete last block to the index
+	if (header->record_count % PACKET_TRACE_BLOCK_RECORD_COUNT != 0 &&
+	    array_append(&_index) != NULL) {
+		*(PacketTraceIndexEntry *)array_get(&_index, _index.count - 1) = _index_entry;
+	}
+
+	index_length = _index.count * sizeof(PacketTraceIndexEntry);
+
+	// without a complete index the reader has to rebuild it
+	if (_index.count == (int)((header->record_count + PACKET_TRACE_BLOCK_RECORD_COUNT - 1) / PACKET_TRACE_BLOCK_RECORD_COUNT) &&
+	    packet_trace_reserve(index_length) >= 0) {
+		header = packet_trace_get_header();
+		header->index_offset = _file_size;
+		header->index_count = _index.count;
+
+		packet_trace_append(_index.bytes, index_length);
+	}
+
+	if (_mapping != NULL) {
+		munmap(_mapping, _mapping_size);
+	}
+
+	if (ftruncate(_fd, (off_t)_file_size) < 0) {
+		log_error("Could not truncate packet trace file %s: %s (%d)",
+		          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+	}
+
+	robust_close(_fd);
+}
+
+static void packet_trace_thread(void *opaque) {
+	(void)opaque;
+
+	packet_trace_open();
+
+	while (__atomic_load_n(&_running, __ATOMIC_ACQUIRE)) {
+		millisleep(FLUSH_INTERVAL);
+		packet_trace_drain();
+	}
+
+	packet_trace_drain();
+	packet_trace_close();
+
+	array_destroy(&_index, NULL);
+	array_destroy(&_records, NULL);
+
+	if (_spans_enabled) {
+		packet_trace_destroy_spans();
+	}
+}
+
+static void packet_trace_exit(void) {
+	__atomic_store_n(&_running, false, __ATOMIC_RELEASE);
+
+	thread_join(&_thread);
+	thread_destroy(&_thread);
+}
+
+static PacketTraceRing *packet_trace_create_ring(void) {
+	PacketTraceRing *ring = calloc(1, sizeof(PacketTraceRing));
+
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	do {
+		ring->next = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE);
+	} while (!__sync_bool_compare_and_swap(&_rings, ring->next, ring));
+
+	_ring = ring;
+
+	if (__sync_bool_compare_and_swap(&_started, false, true)) {
+		if (array_create(&_records, 256, sizeof(PacketTraceRecord), true) < 0) {
+			log_error("Could not create packet trace record array, stopping packet trace: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return ring; // the ring will just be full forever
+		}
+
+		if (array_create(&_index, 64, sizeof(PacketTraceIndexEntry), true) < 0) {
+			log_error("Could not create packet trace index array, stopping packet trace: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			array_destroy(&_records, NULL);
+
+			return ring;
+		}
+
+		if (packet_trace_create_spans() < 0) {
+			log_error("Could not create packet trace span tracker: %s (%d)",
+			          get_errno_name(errno), errno);
+		} else {
+			// publish after the span mutex was created, packet_trace_dump_spans
+			// might already be waiting for it
+			__atomic_store_n(&_spans_enabled, true, __ATOMIC_RELEASE);
+		}
+
+		_running = true;
+
+		thread_create(&_thread, packet_trace_thread, NULL);
+		atexit(packet_trace_exit);
+	}
+
+	return ring;
+}
+
+void packet_trace_add(uint64_t trace_id, PacketHeader *header, const char *filename, int line) {
+	PacketTraceRing *ring = _ring;
+	PacketTraceRecord *record;
+	uint32_t write_index;
+
+	if (ring == NULL) {
+		ring = packet_trace_create_ring();
+
+		if (ring == NULL) {
+			return;
+		}
+	}
+
+	write_index = ring->write_index;
+
+	if (write_index - __atomic_load_n(&ring->read_index, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+		__sync_fetch_and_add(&ring->dropped, 1);
+
+		return;
+	}
+
+	record = &ring->records[write_index & RING_MASK];
+
+	record->trace_id = trace_id;
+	record->timestamp = microtime();
+	record->header = *header;
+	record->filename_id = packet_trace_intern_filename(filename);
+	record->line = line;
+
+	__atomic_store_n(&ring->write_index, write_index + 1, __ATOMIC_RELEASE);
+}
+
+// logs the latency histograms of all spans recorded so far. can be called
+// from any thread
+void packet_trace_dump_spans(void) {
+	PacketTraceSpanStatistics *statistics;
+	int i;
+	int bucket;
+	char base58[BASE58_MAX_LENGTH];
+	char histogram[512];
+	char buffer[64];
+
+	if (!__atomic_load_n(&_spans_enabled, __ATOMIC_ACQUIRE)) {
+		log_info("No packet trace spans recorded");
+
+		return;
+	}
+
+	mutex_lock(&_span_mutex);
+
+	if (!_spans_enabled) {
+		mutex_unlock(&_span_mutex);
+
+		return;
+	}
+
+	for (i = 0; i < _span_statistics.count; ++i) {
+		statistics = array_get(&_span_statistics, i);
+		histogram[0] = '\0';
+
+		for (bucket = 0; bucket < PACKET_TRACE_SPAN_HISTOGRAM_SIZE; ++bucket) {
+			if (statistics->histogram[bucket] == 0) {
+				continue;
+			}
+
+			if (bucket == PACKET_TRACE_SPAN_HISTOGRAM_SIZE - 1) {
+				snprintf(buffer, sizeof(buffer), "%s>=%u: %" PRIu64,
+				         histogram[0] != '\0' ? ", " : "", 1u << (bucket - 1),
+				         statistics->histogram[bucket]);
+			} else {
+				snprintf(buffer, sizeof(buffer), "%s<%u: %" PRIu64,
+				         histogram[0] != '\0' ? ", " : "", 1u << bucket,
+				         statistics->histogram[bucket]);
+			}
+
+			string_append(histogram, sizeof(histogram), buffer);
+		}
+
+		log_info("Packet trace span (U: %s, F: %u): %" PRIu64 " response(s), total: %" PRIu64 " usec, min: %" PRIu64 " usec, max: %" PRIu64 " usec, histogram (usec): [%s]",
+		         base58_encode(base58, uint32_from_le(statistics->uid)),
+		         statistics->function_id, statistics->count,
+		         statistics->total_latency, statistics->min_latency,
+		         statistics->max_latency, histogram);
+	}
+
+	mutex_unlock(&_span_mutex);
+}
+
+#endif
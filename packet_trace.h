@@ -0,0 +1,116 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * packet_trace.h: Packet trace recording specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PACKET_TRACE_H
+#define DAEMONLIB_PACKET_TRACE_H
+
+#include <stdint.h>
+
+#include "packet.h"
+
+#define PACKET_TRACE_FILENAME "/tmp/daemonlib-packet-trace"
+#define PACKET_TRACE_MAGIC "DLPTRACE"
+#define PACKET_TRACE_VERSION 2
+#define PACKET_TRACE_STRING_COUNT 1024 // entries in the string table
+#define PACKET_TRACE_STRING_LENGTH 128 // bytes per string, including NULL-terminator
+#define PACKET_TRACE_BLOCK_RECORD_COUNT 1024 // records per index entry
+#define PACKET_TRACE_UNKNOWN_FILENAME_ID UINT32_MAX
+
+#include "packed_begin.h"
+
+// a trace file consists of four parts, all integers are stored in host byte
+// order:
+//
+// - a PacketTraceFileHeader
+// - a string table of PACKET_TRACE_STRING_COUNT NULL-terminated strings with
+//   PACKET_TRACE_STRING_LENGTH bytes each, indexed by filename ID. unused
+//   entries are empty. overlong filenames are cut at their beginning
+// - RECORD_COUNT PacketTraceRecords. the records that were collected at the
+//   same time are sorted by their timestamp, but records of different threads
+//   might still be slightly out of order
+// - an index of INDEX_COUNT PacketTraceIndexEntries, one per block of
+//   PACKET_TRACE_BLOCK_RECORD_COUNT records. the index is written when the
+//   trace is closed. if the program didn't exit normally then INDEX_OFFSET is
+//   0 and the index has to be rebuilt from the records
+//
+// the string table, RECORD_COUNT and DROPPED_COUNT are kept up-to-date while
+// the trace is written
+typedef struct {
+	char magic[8]; // PACKET_TRACE_MAGIC
+	uint32_t version; // PACKET_TRACE_VERSION
+	uint32_t header_length; // sizeof(PacketTraceFileHeader)
+	uint32_t record_length; // sizeof(PacketTraceRecord)
+	uint32_t block_record_count; // PACKET_TRACE_BLOCK_RECORD_COUNT
+	uint32_t string_count; // PACKET_TRACE_STRING_COUNT
+	uint32_t string_length; // PACKET_TRACE_STRING_LENGTH
+	uint64_t string_table_offset;
+	uint64_t record_offset;
+	uint64_t record_count;
+	uint64_t dropped_count; // records lost because a trace ring was full
+	uint64_t index_offset; // 0 if the index is missing
+	uint64_t index_count;
+} ATTRIBUTE_PACKED PacketTraceFileHeader;
+
+typedef struct {
+	uint64_t trace_id;
+	uint64_t timestamp; // microseconds
+	PacketHeader header;
+	uint32_t filename_id; // index into the string table
+	int32_t line;
+} ATTRIBUTE_PACKED PacketTraceRecord;
+
+// the trace ID ranges are 0 if the block contains no request or no response
+typedef struct {
+	uint64_t first_record;
+	uint64_t min_timestamp; // microseconds
+	uint64_t max_timestamp; // microseconds
+	uint64_t min_request_trace_id;
+	uint64_t max_request_trace_id;
+	uint64_t min_response_trace_id;
+	uint64_t max_response_trace_id;
+} ATTRIBUTE_PACKED PacketTraceIndexEntry;
+
+#include "packed_end.h"
+
+// bucket 0 counts latencies below 1 microsecond, bucket N (N > 0) counts
+// latencies in [2^(N-1), 2^N) microseconds and the last bucket also counts all
+// longer latencies
+#define PACKET_TRACE_SPAN_HISTOGRAM_SIZE 32
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint8_t function_id;
+	uint64_t count; // number of matched responses
+	uint64_t total_latency; // in microseconds
+	uint64_t min_latency; // in microseconds
+	uint64_t max_latency; // in microseconds
+	uint64_t histogram[PACKET_TRACE_SPAN_HISTOGRAM_SIZE];
+} PacketTraceSpanStatistics;
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+
+void packet_trace_add(uint64_t trace_id, PacketHeader *header, const char *filename, int line);
+
+void packet_trace_dump_spans(void);
+
+#endif
+
+#endif // DAEMONLIB_PACKET_TRACE_H
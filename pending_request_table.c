@@ -0,0 +1,357 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_table.c: Pending request table specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a PendingRequestTable object stores requests that wait for their response.
+ * the requests are indexed by UID, function ID and sequence number, the same
+ * fields packet_is_matching_response compares. this allows to route a
+ * response to its request in constant time, instead of comparing it to all
+ * pending requests one by one. requests with the same key are chained in the
+ * order they were inserted, a response always matches the oldest of them.
+ *
+ * additionally, all requests are stored in a binary min-heap ordered by their
+ * deadline. a single timer is configured for the earliest deadline. when it
+ * expires all requests that reached their deadline in the meantime are
+ * removed in one go and the expire function is called for each of them.
+ */
+
+#include <errno.h>
+
+#include "pending_request_table.h"
+
+#include "log.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+static uint64_t pending_request_table_get_key(PacketHeader *header) {
+	return ((uint64_t)header->uid << 12) |
+	       ((uint64_t)header->function_id << 4) |
+	       packet_header_get_sequence_number(header);
+}
+
+static PendingRequestEntry *pending_request_table_get_heap(PendingRequestTable *table, int i) {
+	return *(PendingRequestEntry **)array_get(&table->heap, i);
+}
+
+static void pending_request_table_set_heap(PendingRequestTable *table, int i,
+                                           PendingRequestEntry *entry) {
+	*(PendingRequestEntry **)array_get(&table->heap, i) = entry;
+
+	entry->heap_index = i;
+}
+
+static void pending_request_table_sift_up(PendingRequestTable *table, int i) {
+	PendingRequestEntry *entry = pending_request_table_get_heap(table, i);
+	PendingRequestEntry *parent;
+
+	while (i > 0) {
+		parent = pending_request_table_get_heap(table, (i - 1) / 2);
+
+		if (parent->deadline <= entry->deadline) {
+			break;
+		}
+
+		pending_request_table_set_heap(table, i, parent);
+
+		i = (i - 1) / 2;
+	}
+
+	pending_request_table_set_heap(table, i, entry);
+}
+
+static void pending_request_table_sift_down(PendingRequestTable *table, int i) {
+	PendingRequestEntry *entry = pending_request_table_get_heap(table, i);
+	PendingRequestEntry *child;
+	int count = table->heap.count;
+	int k;
+
+	while ((k = 2 * i + 1) < count) {
+		child = pending_request_table_get_heap(table, k);
+
+		if (k + 1 < count && pending_request_table_get_heap(table, k + 1)->deadline < child->deadline) {
+			child = pending_request_table_get_heap(table, ++k);
+		}
+
+		if (entry->deadline <= child->deadline) {
+			break;
+		}
+
+		pending_request_table_set_heap(table, i, child);
+
+		i = k;
+	}
+
+	pending_request_table_set_heap(table, i, entry);
+}
+
+// configures the timer for the earliest deadline, if that is earlier than
+// the current timer deadline. if the earliest request got removed then the
+// timer is left as is and just expires early, to avoid reconfiguring it for
+// every matched response
+static void pending_request_table_update_timer(PendingRequestTable *table) {
+	uint64_t deadline;
+	uint64_t now;
+
+	if (table->heap.count == 0) {
+		return;
+	}
+
+	deadline = pending_request_table_get_heap(table, 0)->deadline;
+
+	if (table->timer_deadline != 0 && table->timer_deadline <= deadline) {
+		return;
+	}
+
+	table->timer_deadline = deadline;
+	now = microtime();
+
+	// a delay of 0 would stop the timer
+	timer_configure(&table->timer, deadline > now ? deadline - now : 1, 0);
+}
+
+// removes ENTRY from the index and the heap, but doesn't free it
+static void pending_request_table_unlink(PendingRequestTable *table, PendingRequestEntry *entry) {
+	PendingRequestEntry *previous = hash_table_get(&table->index, entry->key);
+	PendingRequestEntry *last;
+	int i = entry->heap_index;
+
+	if (previous == entry) {
+		hash_table_remove(&table->index, entry->key);
+
+		if (entry->next != NULL) {
+			// cannot fail, because the key was just removed
+			hash_table_insert(&table->index, entry->key, entry->next);
+		}
+	} else {
+		while (previous->next != entry) {
+			previous = previous->next;
+		}
+
+		previous->next = entry->next;
+	}
+
+	last = pending_request_table_get_heap(table, table->heap.count - 1);
+
+	array_remove(&table->heap, table->heap.count - 1, NULL);
+
+	if (last != entry) {
+		pending_request_table_set_heap(table, i, last);
+		pending_request_table_sift_up(table, i);
+		pending_request_table_sift_down(table, last->heap_index);
+	}
+}
+
+static void pending_request_table_handle_timer(void *opaque) {
+	PendingRequestTable *table = opaque;
+	PendingRequestEntry *entry;
+	uint64_t now = microtime();
+	void *entry_opaque;
+
+	// the timer doesn't repeat, it is stopped now
+	table->timer_deadline = 0;
+
+	while (table->heap.count > 0) {
+		entry = pending_request_table_get_heap(table, 0);
+
+		if (entry->deadline > now) {
+			break;
+		}
+
+		entry_opaque = entry->opaque;
+
+		pending_request_table_unlink(table, entry);
+		slab_free(&table->entry_slab, entry);
+
+		// this call might insert or remove entries
+		table->expire(entry_opaque);
+	}
+
+	pending_request_table_update_timer(table);
+}
+
+// creates an empty PendingRequestTable object. EXPIRE is called with the
+// opaque pointer of each request that reaches its deadline without a
+// matching response, after the request was removed from the table.
+//
+// returns -1 on error (sets errno) or 0 on success
+int pending_request_table_create(PendingRequestTable *table,
+                                 PendingRequestExpireFunction expire) {
+	int phase = 0;
+
+	table->timer_deadline = 0;
+	table->expire = expire;
+
+	if (slab_create(&table->entry_slab, sizeof(PendingRequestEntry), 64) < 0) {
+		log_error("Could not create pending request slab: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (hash_table_create(&table->index, 64) < 0) {
+		log_error("Could not create pending request index: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (array_create(&table->heap, 64, sizeof(PendingRequestEntry *), true) < 0) {
+		log_error("Could not create pending request heap: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (timer_create_(&table->timer, pending_request_table_handle_timer, table) < 0) {
+		log_error("Could not create pending request timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		array_destroy(&table->heap, NULL);
+		// fall through
+
+	case 2:
+		hash_table_destroy(&table->index, NULL);
+		// fall through
+
+	case 1:
+		slab_destroy(&table->entry_slab);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 4 ? 0 : -1;
+}
+
+// destroys a PendingRequestTable object. the expire function is not called
+// for requests that are still pending
+void pending_request_table_destroy(PendingRequestTable *table) {
+	timer_destroy(&table->timer);
+	array_destroy(&table->heap, NULL);
+	hash_table_destroy(&table->index, NULL);
+	slab_destroy(&table->entry_slab);
+}
+
+// adds the request with the given header that expires after TIMEOUT (in
+// microseconds) unless a matching response arrives before. OPAQUE (!= NULL)
+// is returned by pending_request_table_match or passed to the expire function.
+//
+// returns NULL on error (sets errno) or the new entry on success
+PendingRequestEntry *pending_request_table_insert(PendingRequestTable *table,
+                                                  PacketHeader *request,
+                                                  uint64_t timeout, void *opaque) {
+	PendingRequestEntry *entry;
+	PendingRequestEntry *previous;
+	PendingRequestEntry **heap_item;
+
+	entry = slab_alloc(&table->entry_slab);
+
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	heap_item = array_append(&table->heap);
+
+	if (heap_item == NULL) {
+		slab_free(&table->entry_slab, entry);
+
+		return NULL;
+	}
+
+	entry->key = pending_request_table_get_key(request);
+	entry->deadline = microtime() + timeout;
+	entry->next = NULL;
+	entry->opaque = opaque;
+
+	previous = hash_table_get(&table->index, entry->key);
+
+	if (previous == NULL) {
+		if (hash_table_insert(&table->index, entry->key, entry) < 0) {
+			array_remove(&table->heap, table->heap.count - 1, NULL);
+			slab_free(&table->entry_slab, entry);
+
+			return NULL;
+		}
+	} else {
+		// another request with the same key is already pending, chain behind
+		// it. this is rare, therefore the chain is just walked to its end
+		while (previous->next != NULL) {
+			previous = previous->next;
+		}
+
+		previous->next = entry;
+	}
+
+	*heap_item = entry;
+	entry->heap_index = table->heap.count - 1;
+
+	pending_request_table_sift_up(table, entry->heap_index);
+	pending_request_table_update_timer(table);
+
+	return entry;
+}
+
+// removes ENTRY without calling the expire function, e.g. if the client that
+// sent the request disconnected
+void pending_request_table_remove(PendingRequestTable *table, PendingRequestEntry *entry) {
+	pending_request_table_unlink(table, entry);
+	slab_free(&table->entry_slab, entry);
+	pending_request_table_update_timer(table);
+}
+
+// removes the oldest request that RESPONSE is matching.
+//
+// returns the opaque pointer of the request or NULL if no request is matching
+void *pending_request_table_match(PendingRequestTable *table, Packet *response) {
+	PendingRequestEntry *entry;
+	void *opaque;
+
+	entry = hash_table_get(&table->index, pending_request_table_get_key(&response->header));
+
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	opaque = entry->opaque;
+
+	pending_request_table_remove(table, entry);
+
+	return opaque;
+}
+
+int pending_request_table_get_count(PendingRequestTable *table) {
+	return table->heap.count;
+}
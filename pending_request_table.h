@@ -0,0 +1,66 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * pending_request_table.h: Pending request table specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_PENDING_REQUEST_TABLE_H
+#define DAEMONLIB_PENDING_REQUEST_TABLE_H
+
+#include <stdint.h>
+
+#include "array.h"
+#include "hash_table.h"
+#include "packet.h"
+#include "slab.h"
+#include "timer.h"
+
+typedef void (*PendingRequestExpireFunction)(void *opaque);
+
+typedef struct _PendingRequestEntry PendingRequestEntry;
+
+struct _PendingRequestEntry {
+	uint64_t key; // (uid, function_id, sequence_number)
+	uint64_t deadline; // in microseconds
+	int heap_index;
+	PendingRequestEntry *next; // next younger entry with the same key
+	void *opaque;
+};
+
+typedef struct {
+	Slab entry_slab; // PendingRequestEntry
+	HashTable index; // (uid, function_id, sequence_number) -> oldest PendingRequestEntry
+	Array heap; // PendingRequestEntry *, ordered by deadline
+	Timer timer;
+	uint64_t timer_deadline; // in microseconds, 0 = timer is stopped
+	PendingRequestExpireFunction expire;
+} PendingRequestTable;
+
+int pending_request_table_create(PendingRequestTable *table,
+                                 PendingRequestExpireFunction expire);
+void pending_request_table_destroy(PendingRequestTable *table);
+
+PendingRequestEntry *pending_request_table_insert(PendingRequestTable *table,
+                                                  PacketHeader *request,
+                                                  uint64_t timeout, void *opaque);
+void pending_request_table_remove(PendingRequestTable *table, PendingRequestEntry *entry);
+void *pending_request_table_match(PendingRequestTable *table, Packet *response);
+
+int pending_request_table_get_count(PendingRequestTable *table);
+
+#endif // DAEMONLIB_PENDING_REQUEST_TABLE_H
@@ -0,0 +1,217 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * sequence_window.c: Per UID sequence number window specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a SequenceWindow object allows to pipeline requests to a single device.
+ * instead of waiting for the response to each request before sending the
+ * next one, up to 15 requests can be in flight at once, each with its own
+ * sequence number. the window tracks which sequence numbers are free, so that
+ * responses can arrive in any order and each one frees the sequence number
+ * of its request.
+ *
+ * the number of requests in flight is additionally limited by credits. this
+ * allows to reduce the window for devices behind slow or lossy links, or to
+ * pause sending entirely by setting the credits to 0. sequence numbers are
+ * handed out round-robin, so a late response to a timed out request is
+ * unlikely to be mistaken for the response to a newer request.
+ *
+ * a SequenceWindowTable object maps UIDs to their SequenceWindow objects and
+ * creates them on demand.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "sequence_window.h"
+
+#include "log.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define ALL_SEQUENCE_NUMBERS_FREE 0xFFFE // bit 0 is never set
+
+// creates an empty SequenceWindow object that allows up to CREDITS requests
+// in flight at once
+void sequence_window_create(SequenceWindow *window, uint32_t uid, int credits) {
+	window->uid = uid;
+	window->free_sequence_numbers = ALL_SEQUENCE_NUMBERS_FREE;
+	window->next_sequence_number = 1;
+	window->in_flight = 0;
+
+	memset(window->function_ids, 0, sizeof(window->function_ids));
+
+	sequence_window_set_credits(window, credits);
+}
+
+// assigns a sequence number to REQUEST. if REQUEST expects a response then
+// its sequence number is reserved and a credit is taken until the response
+// arrives or sequence_window_release is called. otherwise no response will
+// arrive to match, so REQUEST just gets the next free sequence number without
+// reserving it or taking a credit. it never gets a sequence number of a
+// request in flight, otherwise a late response to that request could not be
+// told apart from an unexpected response to REQUEST.
+//
+// returns -1 on error (sets errno to EAGAIN if the window is full or out of
+// credits) or the assigned sequence number on success
+int sequence_window_acquire(SequenceWindow *window, PacketHeader *request) {
+	uint8_t sequence_number = window->next_sequence_number;
+	bool response_expected = packet_header_get_response_expected(request);
+
+	if (response_expected ? sequence_window_get_available(window) == 0
+	                      : window->free_sequence_numbers == 0) {
+		errno = EAGAIN;
+
+		return -1;
+	}
+
+	while ((window->free_sequence_numbers & (1u << sequence_number)) == 0) {
+		sequence_number = sequence_number % SEQUENCE_WINDOW_MAX_IN_FLIGHT + 1;
+	}
+
+	window->next_sequence_number = sequence_number % SEQUENCE_WINDOW_MAX_IN_FLIGHT + 1;
+
+	if (!response_expected) {
+		packet_header_set_sequence_number(request, sequence_number);
+
+		return sequence_number;
+	}
+
+	window->free_sequence_numbers &= ~(1u << sequence_number);
+	window->function_ids[sequence_number] = request->function_id;
+
+	++window->in_flight;
+
+	packet_header_set_sequence_number(request, sequence_number);
+
+	return sequence_number;
+}
+
+// frees SEQUENCE_NUMBER, e.g. if its request timed out.
+//
+// returns true if SEQUENCE_NUMBER was in flight, false otherwise
+bool sequence_window_release(SequenceWindow *window, uint8_t sequence_number) {
+	if (sequence_number == 0 || sequence_number > SEQUENCE_WINDOW_MAX_IN_FLIGHT ||
+	    (window->free_sequence_numbers & (1u << sequence_number)) != 0) {
+		return false;
+	}
+
+	window->free_sequence_numbers |= 1u << sequence_number;
+
+	--window->in_flight;
+
+	return true;
+}
+
+// frees the sequence number of the request that RESPONSE belongs to. like
+// packet_is_matching_response the function ID has to match as well.
+//
+// returns true if RESPONSE matches a request in flight, false if it is a
+// callback or an unexpected response
+bool sequence_window_release_response(SequenceWindow *window, PacketHeader *response) {
+	uint8_t sequence_number = packet_header_get_sequence_number(response);
+
+	if (response->uid != window->uid || sequence_number == 0 ||
+	    window->function_ids[sequence_number] != response->function_id) {
+		return false;
+	}
+
+	return sequence_window_release(window, sequence_number);
+}
+
+// sets the maximum number of requests in flight (0 to 15). if this is less
+// than the number of requests already in flight then no new requests can be
+// sent until enough responses arrived
+void sequence_window_set_credits(SequenceWindow *window, int credits) {
+	if (credits < 0) {
+		credits = 0;
+	} else if (credits > SEQUENCE_WINDOW_MAX_IN_FLIGHT) {
+		credits = SEQUENCE_WINDOW_MAX_IN_FLIGHT;
+	}
+
+	window->credits = credits;
+}
+
+// returns the number of requests that can be sent right now
+int sequence_window_get_available(SequenceWindow *window) {
+	return window->in_flight < window->credits ? window->credits - window->in_flight : 0;
+}
+
+// creates an empty SequenceWindowTable object. new windows allow up to
+// CREDITS requests in flight at once.
+//
+// returns -1 on error (sets errno) or 0 on success
+int sequence_window_table_create(SequenceWindowTable *table, int credits) {
+	table->credits = credits;
+
+	if (slab_create(&table->window_slab, sizeof(SequenceWindow), 64) < 0) {
+		log_error("Could not create sequence window slab: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (hash_table_create(&table->index, 64) < 0) {
+		log_error("Could not create sequence window index: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		slab_destroy(&table->window_slab);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void sequence_window_table_destroy(SequenceWindowTable *table) {
+	hash_table_destroy(&table->index, NULL);
+	slab_destroy(&table->window_slab);
+}
+
+// returns NULL on error (sets errno) or the SequenceWindow object for UID on
+// success. the SequenceWindow object is created if it doesn't exist yet
+SequenceWindow *sequence_window_table_get(SequenceWindowTable *table, uint32_t uid) {
+	SequenceWindow *window = hash_table_get(&table->index, uid);
+
+	if (window != NULL) {
+		return window;
+	}
+
+	window = slab_alloc(&table->window_slab);
+
+	if (window == NULL) {
+		return NULL;
+	}
+
+	sequence_window_create(window, uid, table->credits);
+
+	if (hash_table_insert(&table->index, uid, window) < 0) {
+		slab_free(&table->window_slab, window);
+
+		return NULL;
+	}
+
+	return window;
+}
+
+// removes the SequenceWindow object for UID, e.g. if the device disconnected
+void sequence_window_table_remove(SequenceWindowTable *table, uint32_t uid) {
+	slab_free(&table->window_slab, hash_table_remove(&table->index, uid));
+}
@@ -0,0 +1,65 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * sequence_window.h: Per UID sequence number window specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_SEQUENCE_WINDOW_H
+#define DAEMONLIB_SEQUENCE_WINDOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hash_table.h"
+#include "packet.h"
+#include "slab.h"
+
+// sequence numbers 1 to 15, 0 is used for callbacks
+#define SEQUENCE_WINDOW_MAX_IN_FLIGHT 15
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint16_t free_sequence_numbers; // bit N set = sequence number N is free
+	uint8_t next_sequence_number; // first candidate for the next request
+	uint8_t function_ids[SEQUENCE_WINDOW_MAX_IN_FLIGHT + 1]; // of the requests in flight, by sequence number
+	int in_flight; // number of requests waiting for their response
+	int credits; // maximum number of requests in flight
+} SequenceWindow;
+
+typedef struct {
+	Slab window_slab; // SequenceWindow
+	HashTable index; // uid -> SequenceWindow
+	int credits; // for new windows
+} SequenceWindowTable;
+
+void sequence_window_create(SequenceWindow *window, uint32_t uid, int credits);
+
+int sequence_window_acquire(SequenceWindow *window, PacketHeader *request);
+bool sequence_window_release(SequenceWindow *window, uint8_t sequence_number);
+bool sequence_window_release_response(SequenceWindow *window, PacketHeader *response);
+
+void sequence_window_set_credits(SequenceWindow *window, int credits);
+int sequence_window_get_available(SequenceWindow *window);
+
+int sequence_window_table_create(SequenceWindowTable *table, int credits);
+void sequence_window_table_destroy(SequenceWindowTable *table);
+
+SequenceWindow *sequence_window_table_get(SequenceWindowTable *table, uint32_t uid);
+void sequence_window_table_remove(SequenceWindowTable *table, uint32_t uid);
+
+#endif // DAEMONLIB_SEQUENCE_WINDOW_H
@@ -0,0 +1,90 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * shared_packet.c: Reference counted packet specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a SharedPacket object holds a single copy of a packet that is referenced by
+ * several owners, e.g. the write backlogs of all clients a callback is
+ * broadcast to. it is freed when the last reference is released. the
+ * reference count is updated atomically, so the owners can be handled by
+ * different event loops.
+ *
+ * if the packet pool is initialized then SharedPacket objects are allocated
+ * from it instead of being allocated with malloc each.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared_packet.h"
+
+#include "packet_pool.h"
+
+// creates a SharedPacket object holding a copy of PACKET with a reference
+// count of 1, owned by the caller.
+//
+// returns NULL on error (sets errno) or the new SharedPacket object on success
+SharedPacket *shared_packet_create(Packet *packet) {
+	SharedPacket *shared_packet;
+
+	if (packet_pool_is_initialized()) {
+		shared_packet = packet_pool_alloc();
+
+		if (shared_packet == NULL) {
+			return NULL;
+		}
+	} else {
+		shared_packet = malloc(offsetof(SharedPacket, packet) + packet->header.length);
+
+		if (shared_packet == NULL) {
+			errno = ENOMEM;
+
+			return NULL;
+		}
+
+		shared_packet->ref_count = 1;
+		shared_packet->pooled = false;
+	}
+
+	memcpy(&shared_packet->packet, packet, packet->header.length);
+
+	return shared_packet;
+}
+
+// adds a reference to a SharedPacket object and returns it
+SharedPacket *shared_packet_acquire(SharedPacket *shared_packet) {
+	__sync_add_and_fetch(&shared_packet->ref_count, 1);
+
+	return shared_packet;
+}
+
+// removes a reference from a SharedPacket object and frees it, if this was
+// the last reference
+void shared_packet_release(SharedPacket *shared_packet) {
+	if (__sync_sub_and_fetch(&shared_packet->ref_count, 1) == 0) {
+		if (shared_packet->pooled) {
+			packet_pool_free(shared_packet);
+		} else {
+			free(shared_packet);
+		}
+	}
+}
@@ -1,8 +1,8 @@
 /*
  * daemonlib
- * Copyright (C) 2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
  *
- * timer_posix.h: Poll based timer implementation
+ * shared_packet.h: Reference counted packet specific functions
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -19,29 +19,21 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#ifndef DAEMONLIB_TIMER_POSIX_H
-#define DAEMONLIB_TIMER_POSIX_H
+#ifndef DAEMONLIB_SHARED_PACKET_H
+#define DAEMONLIB_SHARED_PACKET_H
 
 #include <stdbool.h>
-#include <stdint.h>
 
-#include "io.h"
-#include "pipe.h"
-#include "threads.h"
-
-typedef void (*TimerFunction)(void *opaque);
+#include "packet.h"
 
 typedef struct {
-	Pipe notification_pipe;
-	Pipe interrupt_pipe;
-	Semaphore handshake;
-	Thread thread;
-	bool running;
-	uint64_t delay; // in microseconds
-	uint64_t interval; // in microseconds
-	uint32_t configuration_id;
-	TimerFunction function;
-	void *opaque;
-} Timer;
+	int ref_count;
+	bool pooled; // allocated by the packet pool
+	Packet packet; // only header.length bytes are allocated, unless pooled
+} SharedPacket;
+
+SharedPacket *shared_packet_create(Packet *packet);
+SharedPacket *shared_packet_acquire(SharedPacket *shared_packet);
+void shared_packet_release(SharedPacket *shared_packet);
 
-#endif // DAEMONLIB_TIMER_POSIX_H
+#endif // DAEMONLIB_SHARED_PACKET_H
@@ -67,6 +67,10 @@ static void signal_handle(void *opaque) {
 		if (_handle_sigusr1 != NULL) {
 			_handle_sigusr1();
 		}
+
+#ifdef DAEMONLIB_WITH_EVENT_STATISTICS
+		event_dump_statistics();
+#endif
 	} else {
 		log_warn("Received unexpected signal %d", signal_number);
 	}
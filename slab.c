@@ -0,0 +1,134 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * slab.c: Slab allocator specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * a Slab object allocates objects of a fixed size from larger chunks of memory
+ * instead of allocating each object separately. the objects are aligned to
+ * SLAB_ALIGNMENT bytes, so an object never shares a cache line with another
+ * object and objects allocated in a row are next to each other in memory.
+ * freed objects are kept in a free list for reuse. the chunks are only freed
+ * when the Slab object is destroyed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+// returns -1 on error (sets errno) or 0 on success
+static int slab_grow(Slab *slab) {
+	uint8_t *chunk;
+	uint8_t *object;
+	void **slot;
+	int i;
+
+	slot = array_append(&slab->chunks);
+
+	if (slot == NULL) {
+		return -1;
+	}
+
+	chunk = malloc((size_t)slab->size * slab->chunk_count + SLAB_ALIGNMENT - 1);
+
+	if (chunk == NULL) {
+		array_remove(&slab->chunks, slab->chunks.count - 1, NULL);
+
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	*slot = chunk;
+
+	object = (uint8_t *)(((uintptr_t)chunk + SLAB_ALIGNMENT - 1) & ~(uintptr_t)(SLAB_ALIGNMENT - 1));
+
+	// push the objects in reverse order, so they are handed out in ascending
+	// memory order
+	for (i = slab->chunk_count - 1; i >= 0; --i) {
+		*(void **)(object + (size_t)slab->size * i) = slab->free_list;
+		slab->free_list = object + (size_t)slab->size * i;
+	}
+
+	return 0;
+}
+
+// creates an empty Slab object for objects of SIZE (> 0) bytes, that allocates
+// memory for CHUNK_COUNT (> 0) objects at once.
+//
+// returns -1 on error (sets errno) or 0 on success
+int slab_create(Slab *slab, int size, int chunk_count) {
+	if (size < (int)sizeof(void *)) {
+		size = sizeof(void *);
+	}
+
+	slab->size = (size + SLAB_ALIGNMENT - 1) / SLAB_ALIGNMENT * SLAB_ALIGNMENT;
+	slab->chunk_count = chunk_count;
+	slab->count = 0;
+	slab->free_list = NULL;
+
+	return array_create(&slab->chunks, 8, sizeof(void *), true);
+}
+
+static void slab_free_chunk(void *item) {
+	free(*(void **)item);
+}
+
+// destroys a Slab object and frees all its memory, including the memory of
+// objects that are still allocated
+void slab_destroy(Slab *slab) {
+	array_destroy(&slab->chunks, slab_free_chunk);
+}
+
+// allocates an object from a Slab object. the memory of the object is
+// initialized to zero.
+//
+// returns NULL on error (sets errno) or a pointer to the object on success
+void *slab_alloc(Slab *slab) {
+	void *object;
+
+	if (slab->free_list == NULL && slab_grow(slab) < 0) {
+		return NULL;
+	}
+
+	object = slab->free_list;
+	slab->free_list = *(void **)object;
+
+	memset(object, 0, slab->size);
+
+	++slab->count;
+
+	return object;
+}
+
+// returns OBJECT to the Slab object it was allocated from
+void slab_free(Slab *slab, void *object) {
+	if (object == NULL) {
+		return;
+	}
+
+	*(void **)object = slab->free_list;
+	slab->free_list = object;
+
+	--slab->count;
+}
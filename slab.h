@@ -0,0 +1,44 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * slab.h: Slab allocator specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef DAEMONLIB_SLAB_H
+#define DAEMONLIB_SLAB_H
+
+#include "array.h"
+
+#define SLAB_ALIGNMENT 64 // cache line size of the common targets
+
+typedef struct {
+	int size; // size of a single object in bytes, multiple of SLAB_ALIGNMENT
+	int chunk_count; // number of objects per chunk
+	int count; // number of allocated objects
+	void *free_list; // free objects, linked through their first bytes
+	Array chunks; // void *, as returned by malloc
+} Slab;
+
+int slab_create(Slab *slab, int size, int chunk_count);
+void slab_destroy(Slab *slab);
+
+void *slab_alloc(Slab *slab);
+void slab_free(Slab *slab, void *object);
+
+#endif // DAEMONLIB_SLAB_H
@@ -39,6 +39,7 @@ extern int socket_accept_platform(Socket *socket, Socket *accepted_socket,
 extern int socket_listen_platform(Socket *socket, int backlog);
 extern int socket_receive_platform(Socket *socket, void *buffer, int length);
 extern int socket_send_platform(Socket *socket, const void *buffer, int length);
+extern int socket_send_vector_platform(Socket *socket, const IOVector *vectors, int count);
 
 static const char *socket_get_address_family_name(int family, bool dual_stack) {
 	switch (family) {
@@ -63,12 +64,14 @@ int socket_create(Socket *socket) {
 		return -1;
 	}
 
+	socket->base.write_vector = (IOWriteVectorFunction)socket_send_vector;
 	socket->handle = IO_HANDLE_INVALID;
 	socket->family = AF_UNSPEC;
 	socket->create_allocated = NULL;
 	socket->destroy = socket_destroy_platform;
 	socket->receive = socket_receive_platform;
 	socket->send = socket_send_platform;
+	socket->send_vector = socket_send_vector_platform;
 
 	return 0;
 }
@@ -152,6 +155,20 @@ int socket_send(Socket *socket, const void *buffer, int length) {
 	return socket->send(socket, buffer, length);
 }
 
+// sets errno on error
+int socket_send_vector(Socket *socket, const IOVector *vectors, int count) {
+	// a subclass that replaces the send function (e.g. to add framing) has to
+	// replace the send_vector function as well. otherwise the vectors would
+	// bypass its send function, so only send the first vector through it
+	if (socket->send_vector == NULL ||
+	    (socket->send_vector == socket_send_vector_platform &&
+	     socket->send != socket_send_platform)) {
+		return socket_send(socket, vectors[0].buffer, vectors[0].length);
+	}
+
+	return socket->send_vector(socket, vectors, count);
+}
+
 // logs errors
 void socket_open_server(Array *sockets, const char *address, uint16_t port, bool dual_stack,
                         SocketCreateAllocatedFunction create_allocated) {
@@ -40,6 +40,7 @@ typedef Socket *(*SocketCreateAllocatedFunction)(void);
 typedef void (*SocketDestroyFunction)(Socket *socket);
 typedef int (*SocketReceiveFunction)(Socket *socket, void *buffer, int length);
 typedef int (*SocketSendFunction)(Socket *socket, const void *buffer, int length);
+typedef int (*SocketSendVectorFunction)(Socket *socket, const IOVector *vectors, int count);
 
 struct _Socket {
 	IO base;
@@ -50,6 +51,7 @@ struct _Socket {
 	SocketDestroyFunction destroy;
 	SocketReceiveFunction receive;
 	SocketSendFunction send;
+	SocketSendVectorFunction send_vector;
 };
 
 // FIXME: maybe merge socket_create and socket_open
@@ -68,6 +70,7 @@ int socket_connect(Socket *socket, struct sockaddr *address, int length);
 
 int socket_receive(Socket *socket, void *buffer, int length);
 int socket_send(Socket *socket, const void *buffer, int length);
+int socket_send_vector(Socket *socket, const IOVector *vectors, int count);
 
 int socket_set_address_reuse(Socket *socket, bool address_reuse);
 int socket_set_dual_stack(Socket *socket, bool dual_stack);
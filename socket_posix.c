@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
@@ -145,6 +146,35 @@ int socket_send_platform(Socket *socket, const void *buffer, int length) {
 	return send(socket->handle, buffer, length, flags);
 }
 
+// sets errno on error
+int socket_send_vector_platform(Socket *socket, const IOVector *vectors, int count) {
+#ifdef MSG_NOSIGNAL
+	int flags = MSG_NOSIGNAL;
+#else
+	int flags = 0;
+#endif
+	struct iovec iov[IO_MAX_VECTOR_COUNT];
+	struct msghdr message;
+	int i;
+
+	if (count > IO_MAX_VECTOR_COUNT) {
+		count = IO_MAX_VECTOR_COUNT;
+	}
+
+	for (i = 0; i < count; ++i) {
+		iov[i].iov_base = (void *)vectors[i].buffer;
+		iov[i].iov_len = vectors[i].length;
+	}
+
+	memset(&message, 0, sizeof(message));
+
+	message.msg_iov = iov;
+	message.msg_iovlen = count;
+
+	// use sendmsg instead of writev to be able to pass MSG_NOSIGNAL
+	return sendmsg(socket->handle, &message, flags);
+}
+
 // sets errno on error
 int socket_set_address_reuse(Socket *socket, bool address_reuse) {
 	int on = address_reuse ? 1 : 0;
@@ -170,6 +170,30 @@ int socket_send_platform(Socket *socket, const void *buffer, int length) {
 	return length;
 }
 
+// sets errno on error
+int socket_send_vector_platform(Socket *socket, const IOVector *vectors, int count) {
+	WSABUF buffers[IO_MAX_VECTOR_COUNT];
+	DWORD length;
+	int i;
+
+	if (count > IO_MAX_VECTOR_COUNT) {
+		count = IO_MAX_VECTOR_COUNT;
+	}
+
+	for (i = 0; i < count; ++i) {
+		buffers[i].buf = (CHAR *)vectors[i].buffer;
+		buffers[i].len = (ULONG)vectors[i].length;
+	}
+
+	if (WSASend(socket->handle, buffers, (DWORD)count, &length, 0, NULL, NULL) == SOCKET_ERROR) {
+		errno = ERRNO_WINAPI_OFFSET + WSAGetLastError();
+
+		return -1;
+	}
+
+	return (int)length;
+}
+
 // sets errno on error
 int socket_set_address_reuse(Socket *socket, bool address_reuse) {
 	DWORD on = address_reuse ? TRUE : FALSE;
@@ -23,8 +23,6 @@
 	#include "timer_uwp.c"
 #elif defined _WIN32
 	#include "timer_winapi.c"
-#elif defined __linux__ && !defined __ANDROID__
-	#include "timer_linux.c"
 #else
-	#include "timer_posix.c"
+	#include "timer_event.c"
 #endif
@@ -28,10 +28,8 @@
 	#include "timer_uwp.h"
 #elif defined _WIN32
 	#include "timer_winapi.h"
-#elif defined __linux__ && !defined __ANDROID__
-	#include "timer_linux.h"
 #else
-	#include "timer_posix.h"
+	#include "timer_event.h"
 #endif
 
 int timer_create_(Timer *timer, TimerFunction function, void *opaque);
@@ -0,0 +1,106 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_event.c: Event loop driven timer implementation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * the timers are stored in the timer wheel of the event loop that was current
+ * when they got created. the event loop uses the next expiration as timeout
+ * while waiting for events. therefore, a timer requires no file descriptor
+ * and no thread of its own. a timer must only be configured and destroyed by
+ * the thread running its event loop.
+ */
+
+#include "timer_event.h"
+
+#include "event.h"
+#include "log.h"
+#include "utils.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+// convert from microseconds to milliseconds, rounding up to never expire early
+static uint64_t timer_get_expires(Timer *timer) {
+	return (timer->deadline + 999) / 1000;
+}
+
+static void timer_handle_expire(void *opaque) {
+	Timer *timer = opaque;
+	uint64_t now;
+
+	if (timer->interval > 0) {
+		now = microtime();
+
+		timer->deadline += timer->interval;
+
+		// the timer function will only be called once, even if the timer
+		// expired more than once since the last call. the timer keeps its
+		// phase in this case
+		if (timer->deadline <= now) {
+			timer->deadline += ((now - timer->deadline) / timer->interval + 1) * timer->interval;
+		}
+
+		timer_wheel_schedule(&timer->loop->timer_wheel, &timer->entry,
+		                     timer_get_expires(timer));
+	}
+
+	// this call might reconfigure or destroy the timer
+	timer->function(timer->opaque);
+}
+
+int timer_create_(Timer *timer, TimerFunction function, void *opaque) {
+	timer->loop = event_get_current_loop();
+	timer->deadline = 0;
+	timer->interval = 0;
+	timer->function = function;
+	timer->opaque = opaque;
+
+	timer_wheel_entry_create(&timer->entry, timer_handle_expire, timer);
+
+	log_debug("Created timer (timer: %p)", (void *)timer);
+
+	return 0;
+}
+
+void timer_destroy(Timer *timer) {
+	log_debug("Destroying timer (timer: %p)", (void *)timer);
+
+	timer_wheel_cancel(&timer->loop->timer_wheel, &timer->entry);
+}
+
+// setting delay and interval to 0 stops the timer
+int timer_configure(Timer *timer, uint64_t delay, uint64_t interval) { // microseconds
+	timer_wheel_cancel(&timer->loop->timer_wheel, &timer->entry);
+
+	timer->interval = interval;
+
+	if (delay == 0 && interval == 0) {
+		return 0;
+	}
+
+	// a repeated timer without initial delay expires immediately for the
+	// first time
+	timer->deadline = microtime() + delay;
+
+	timer_wheel_schedule(&timer->loop->timer_wheel, &timer->entry,
+	                     timer_get_expires(timer));
+
+	return 0;
+}
@@ -1,8 +1,8 @@
 /*
  * daemonlib
- * Copyright (C) 2014 Matthias Bolte <matthias@tinkerforge.com>
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
  *
- * timer_linux.h: timerfd based timer implementation for Linux
+ * timer_event.h: Event loop driven timer implementation
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -19,17 +19,23 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#ifndef DAEMONLIB_TIMER_LINUX_H
-#define DAEMONLIB_TIMER_LINUX_H
+#ifndef DAEMONLIB_TIMER_EVENT_H
+#define DAEMONLIB_TIMER_EVENT_H
 
-#include "io.h"
+#include <stdint.h>
+
+#include "event.h"
+#include "timer_wheel.h"
 
 typedef void (*TimerFunction)(void *opaque);
 
 typedef struct {
-	IOHandle handle;
+	TimerWheelEntry entry;
+	EventLoop *loop;
+	uint64_t deadline; // in microseconds
+	uint64_t interval; // in microseconds
 	TimerFunction function;
 	void *opaque;
 } Timer;
 
-#endif // DAEMONLIB_TIMER_LINUX_H
+#endif // DAEMONLIB_TIMER_EVENT_H
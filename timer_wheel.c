@@ -0,0 +1,283 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_wheel.c: Hierarchical timer wheel specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a TimerWheel object stores entries that expire at a given millisecond. it
+ * consists of several levels of 64 slots each. a slot on level L covers 64^L
+ * milliseconds. each entry is stored on the lowest level on which its slot is
+ * less than a full rotation ahead of the slot of the current time. once the
+ * current time reaches the start of a slot on a higher level, the entries of
+ * that slot are redistributed (cascaded) to the lower levels, until they end
+ * up on level 0 and expire. entries that are further ahead than the highest
+ * level can cover are stored in its last slot and get cascaded again.
+ *
+ * scheduling and canceling an entry is O(1). a bitmap per level marks the
+ * non-empty slots. this allows to find the next point in time at which
+ * something has to be done without iterating empty slots, which is used to
+ * calculate the timeout for the event loop and to skip idle time.
+ */
+
+#include <limits.h>
+
+#include "timer_wheel.h"
+
+#include "macros.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOT_COUNT - 1)
+
+static int timer_wheel_get_shift(int level) {
+	return level * TIMER_WHEEL_LEVEL_BITS;
+}
+
+static void timer_wheel_insert(TimerWheel *wheel, TimerWheelEntry *entry) {
+	int level;
+	int shift;
+	uint64_t ahead;
+
+	if (entry->expires <= wheel->now) {
+		entry->level = -1;
+		entry->slot = 0;
+
+		node_insert_before(&wheel->expired_sentinel, &entry->node);
+
+		return;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+		shift = timer_wheel_get_shift(level);
+		ahead = (entry->expires >> shift) - (wheel->now >> shift);
+
+		if (ahead < TIMER_WHEEL_SLOT_COUNT) {
+			break;
+		}
+	}
+
+	if (level == TIMER_WHEEL_LEVEL_COUNT) {
+		level = TIMER_WHEEL_LEVEL_COUNT - 1;
+		shift = timer_wheel_get_shift(level);
+		ahead = TIMER_WHEEL_SLOT_COUNT - 1;
+	}
+
+	entry->level = level;
+	entry->slot = (int)(((wheel->now >> shift) + ahead) & SLOT_MASK);
+
+	node_insert_before(&wheel->slots[level][entry->slot], &entry->node);
+
+	wheel->occupied[level] |= UINT64_C(1) << entry->slot;
+}
+
+// returns the start of the next non-empty slot on any level, or UINT64_MAX
+static uint64_t timer_wheel_get_next_tick(TimerWheel *wheel) {
+	uint64_t next = UINT64_MAX;
+	uint64_t tick;
+	uint64_t occupied;
+	int level;
+	int shift;
+	int current;
+	int ahead;
+
+	for (level = 0; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+		if (wheel->occupied[level] == 0) {
+			continue;
+		}
+
+		shift = timer_wheel_get_shift(level);
+		current = (int)((wheel->now >> shift) & SLOT_MASK);
+
+		// rotate the bitmap so that bit 0 is the slot after the current one
+		occupied = wheel->occupied[level];
+		occupied = (occupied >> ((current + 1) & SLOT_MASK)) |
+		           (occupied << ((TIMER_WHEEL_SLOT_COUNT - current - 1) & SLOT_MASK));
+		ahead = __builtin_ctzll(occupied) + 1;
+		tick = ((wheel->now >> shift) + (uint64_t)ahead) << shift;
+
+		if (tick < next) {
+			next = tick;
+		}
+	}
+
+	return next;
+}
+
+// moves all entries of a slot to the expired list (level 0) or to the lower
+// levels (higher levels)
+static void timer_wheel_cascade(TimerWheel *wheel, int level, int slot) {
+	Node *sentinel = &wheel->slots[level][slot];
+	TimerWheelEntry *entry;
+
+	wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+
+	while (sentinel->next != sentinel) {
+		entry = containerof(sentinel->next, TimerWheelEntry, node);
+
+		node_remove(&entry->node);
+		timer_wheel_insert(wheel, entry);
+	}
+}
+
+void timer_wheel_create(TimerWheel *wheel, uint64_t now) {
+	int level;
+	int slot;
+
+	wheel->now = now;
+	wheel->count = 0;
+
+	node_reset(&wheel->expired_sentinel);
+
+	for (level = 0; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+		wheel->occupied[level] = 0;
+
+		for (slot = 0; slot < TIMER_WHEEL_SLOT_COUNT; ++slot) {
+			node_reset(&wheel->slots[level][slot]);
+		}
+	}
+}
+
+void timer_wheel_entry_create(TimerWheelEntry *entry, TimerWheelFunction function,
+                              void *opaque) {
+	node_reset(&entry->node);
+
+	entry->expires = 0;
+	entry->scheduled = false;
+	entry->level = -1;
+	entry->slot = 0;
+	entry->function = function;
+	entry->opaque = opaque;
+}
+
+// schedules ENTRY to expire at EXPIRES (in milliseconds). if ENTRY is already
+// scheduled then it is rescheduled. if EXPIRES is not in the future then
+// ENTRY expires on the next call to timer_wheel_advance
+void timer_wheel_schedule(TimerWheel *wheel, TimerWheelEntry *entry, uint64_t expires) {
+	timer_wheel_cancel(wheel, entry);
+
+	entry->expires = expires;
+	entry->scheduled = true;
+
+	timer_wheel_insert(wheel, entry);
+
+	++wheel->count;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerWheelEntry *entry) {
+	if (!entry->scheduled) {
+		return;
+	}
+
+	node_remove(&entry->node);
+
+	if (entry->level >= 0 &&
+	    wheel->slots[entry->level][entry->slot].next == &wheel->slots[entry->level][entry->slot]) {
+		wheel->occupied[entry->level] &= ~(UINT64_C(1) << entry->slot);
+	}
+
+	entry->scheduled = false;
+
+	--wheel->count;
+}
+
+// returns the number of milliseconds from NOW until the next entry might
+// expire, 0 if an entry is already expired or -1 if no entry is scheduled.
+// the result can be earlier than the actual expiration of the next entry,
+// because entries on higher levels need to be cascaded first
+int timer_wheel_get_timeout(TimerWheel *wheel, uint64_t now) {
+	uint64_t next;
+
+	if (wheel->expired_sentinel.next != &wheel->expired_sentinel) {
+		return 0;
+	}
+
+	next = timer_wheel_get_next_tick(wheel);
+
+	if (next == UINT64_MAX) {
+		return -1;
+	}
+
+	if (next <= now) {
+		return 0;
+	}
+
+	if (next - now > INT_MAX) {
+		return INT_MAX;
+	}
+
+	return (int)(next - now);
+}
+
+// advances the current time of the wheel to NOW (in milliseconds) and calls
+// the functions of all entries that expired until then. an expired entry is
+// unscheduled before its function is called. the functions are allowed to
+// schedule and cancel entries. entries that are scheduled to expire by those
+// functions before or at NOW will be handled by the next call
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now) {
+	uint64_t next;
+	int level;
+	int shift;
+	Node marker;
+	TimerWheelEntry *entry;
+
+	// jump from one non-empty slot to the next, instead of stepping through
+	// all the milliseconds in between
+	while (wheel->now < now) {
+		next = timer_wheel_get_next_tick(wheel);
+
+		if (next > now) {
+			wheel->now = now;
+
+			break;
+		}
+
+		wheel->now = next;
+
+		for (level = TIMER_WHEEL_LEVEL_COUNT - 1; level >= 0; --level) {
+			shift = timer_wheel_get_shift(level);
+
+			if ((next & ((UINT64_C(1) << shift) - 1)) != 0) {
+				continue;
+			}
+
+			if ((wheel->occupied[level] & (UINT64_C(1) << ((next >> shift) & SLOT_MASK))) != 0) {
+				timer_wheel_cascade(wheel, level, (int)((next >> shift) & SLOT_MASK));
+			}
+		}
+	}
+
+	if (wheel->expired_sentinel.next == &wheel->expired_sentinel) {
+		return;
+	}
+
+	node_insert_before(&wheel->expired_sentinel, &marker);
+
+	while (wheel->expired_sentinel.next != &marker) {
+		entry = containerof(wheel->expired_sentinel.next, TimerWheelEntry, node);
+
+		node_remove(&entry->node);
+
+		entry->scheduled = false;
+
+		--wheel->count;
+
+		// this call might schedule or cancel any entry
+		entry->function(entry->opaque);
+	}
+
+	node_remove(&marker);
+}
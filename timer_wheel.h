@@ -0,0 +1,65 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_wheel.h: Hierarchical timer wheel specific functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_TIMER_WHEEL_H
+#define DAEMONLIB_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "node.h"
+
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_SLOT_COUNT (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVEL_COUNT 6
+
+typedef void (*TimerWheelFunction)(void *opaque);
+
+typedef struct {
+	Node node;
+	uint64_t expires; // in milliseconds
+	bool scheduled;
+	int level; // -1 if expired
+	int slot;
+	TimerWheelFunction function;
+	void *opaque;
+} TimerWheelEntry;
+
+typedef struct {
+	uint64_t now; // in milliseconds, all entries up to this tick are handled
+	int count; // number of scheduled entries
+	Node expired_sentinel;
+	uint64_t occupied[TIMER_WHEEL_LEVEL_COUNT]; // one bit per non-empty slot
+	Node slots[TIMER_WHEEL_LEVEL_COUNT][TIMER_WHEEL_SLOT_COUNT];
+} TimerWheel;
+
+void timer_wheel_create(TimerWheel *wheel, uint64_t now);
+
+void timer_wheel_entry_create(TimerWheelEntry *entry, TimerWheelFunction function,
+                              void *opaque);
+
+void timer_wheel_schedule(TimerWheel *wheel, TimerWheelEntry *entry, uint64_t expires);
+void timer_wheel_cancel(TimerWheel *wheel, TimerWheelEntry *entry);
+
+int timer_wheel_get_timeout(TimerWheel *wheel, uint64_t now);
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now);
+
+#endif // DAEMONLIB_TIMER_WHEEL_H
@@ -19,7 +19,24 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/*
+ * a Writer object writes Packets or, if created by writer_create_framed,
+ * frames of any length. its write backlog is a contiguous byte ring. each
+ * queued packet or frame is stored as a small entry header followed by only
+ * its actual bytes (header.length for Packets), without padding it to the size
+ * of a Packet. an entry is never split at the end of the buffer. if
+ * it doesn't fit there anymore, but does fit in front of the first entry,
+ * then the remaining bytes at the end are skipped (the wrap offset marks
+ * them) and the entry is stored at the beginning of the buffer. otherwise the
+ * buffer is grown and the entries are moved to its beginning.
+ *
+ * the buffer is kept allocated while the backlog is drained and refilled, so
+ * there are no memory allocations on the write path in the steady state.
+ */
+
 #include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "writer.h"
@@ -31,71 +48,835 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define MAX_QUEUED_WRITES 32768
 #define DROPPED_PACKETS_WARNING_INTERVAL 5000 // milliseconds
+#define BACKLOG_MIN_SIZE 4096 // bytes
+#define BACKLOG_MAX_RETAINED_SIZE 65536 // bytes
+#define SLOW_CLIENT_WINDOW 128 // packets
+#define BACKLOG_ENTRY_ALIGNMENT ((int)__alignof__(WriterBacklogEntry))
 
-static void writer_handle_write(void *opaque) {
-	Writer *writer = opaque;
-	PartialPacket *partial_packet;
-	void *remaining_data;
+#define BACKLOG_ENTRY_FLAG_DROPPED 0x0001
+#define BACKLOG_ENTRY_FLAG_SHARED  0x0002 // entry stores a SharedPacket pointer instead of the packet
+
+static int writer_backlog_get_entry_size(int length) {
+	int size = (int)sizeof(WriterBacklogEntry) + length;
+
+	return (size + BACKLOG_ENTRY_ALIGNMENT - 1) & ~(BACKLOG_ENTRY_ALIGNMENT - 1);
+}
+
+static WriterBacklogEntry *writer_backlog_get_entry(WriterBacklog *backlog, int offset) {
+	return (WriterBacklogEntry *)(backlog->buffer + offset);
+}
+
+static int writer_backlog_get_offset(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	return (int)((uint8_t *)entry - backlog->buffer);
+}
+
+static void *writer_backlog_get_data(WriterBacklogEntry *entry) {
+	return (uint8_t *)entry + sizeof(WriterBacklogEntry);
+}
+
+static int writer_backlog_get_data_length(WriterBacklogEntry *entry) {
+	if ((entry->flags & BACKLOG_ENTRY_FLAG_SHARED) != 0) {
+		return (int)sizeof(SharedPacket *);
+	}
+
+	return entry->length;
+}
+
+static void *writer_backlog_get_frame(WriterBacklogEntry *entry) {
+	if ((entry->flags & BACKLOG_ENTRY_FLAG_SHARED) != 0) {
+		return &(*(SharedPacket **)writer_backlog_get_data(entry))->packet;
+	}
+
+	return writer_backlog_get_data(entry);
+}
+
+// returns the offset of the entry following the entry at OFFSET
+static int writer_backlog_get_next(WriterBacklog *backlog, int offset) {
+	WriterBacklogEntry *entry = writer_backlog_get_entry(backlog, offset);
+
+	offset += writer_backlog_get_entry_size(writer_backlog_get_data_length(entry));
+
+	if (offset == backlog->wrap) {
+		offset = 0;
+	}
+
+	return offset;
+}
+
+// enumerate callbacks report state changes of different devices. each of
+// them has to be delivered, so they are not coalesced
+static bool writer_backlog_is_coalescable_packet(WriterBacklog *backlog, Packet *packet) {
+	return backlog->policy == WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS &&
+	       packet_header_get_sequence_number(&packet->header) == 0 &&
+	       packet->header.function_id != CALLBACK_ENUMERATE;
+}
+
+static bool writer_backlog_is_coalescable(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	return writer_backlog_is_coalescable_packet(backlog, writer_backlog_get_frame(entry));
+}
+
+static uint64_t writer_backlog_get_key(Packet *packet) {
+	return ((uint64_t)packet->header.uid << 8) | packet->header.function_id;
+}
+
+// the first packet cannot be changed or dropped anymore after it was partly
+// written, otherwise the recipient would receive a broken byte stream
+static bool writer_backlog_is_locked(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	return backlog->written > 0 && writer_backlog_get_offset(backlog, entry) == backlog->head;
+}
+
+// returns the queued callback with the same UID and function ID as PACKET or
+// NULL if there is none or if PACKET is not a coalescable callback
+static WriterBacklogEntry *writer_backlog_find_callback(WriterBacklog *backlog, Packet *packet) {
+	if (!writer_backlog_is_coalescable_packet(backlog, packet)) {
+		return NULL;
+	}
+
+	return hash_table_get(&backlog->callback_index, writer_backlog_get_key(packet));
+}
+
+// stores ENTRY as the latest callback for its UID and function ID, replacing
+// the previously stored entry (if any). this cannot fail if a previously
+// stored entry was replaced
+static int writer_backlog_index_callback(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	uint64_t key;
+
+	if (!writer_backlog_is_coalescable(backlog, entry)) {
+		return 0;
+	}
+
+	key = writer_backlog_get_key(writer_backlog_get_frame(entry));
+
+	hash_table_remove(&backlog->callback_index, key);
+
+	return hash_table_insert(&backlog->callback_index, key, entry);
+}
+
+static void writer_backlog_unindex_callback(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	uint64_t key;
+
+	if (!writer_backlog_is_coalescable(backlog, entry)) {
+		return;
+	}
+
+	key = writer_backlog_get_key(writer_backlog_get_frame(entry));
+
+	if (hash_table_get(&backlog->callback_index, key) == entry) {
+		hash_table_remove(&backlog->callback_index, key);
+	}
+}
+
+static void writer_backlog_create(WriterBacklog *backlog) {
+	backlog->policy = WRITER_BACKLOG_POLICY_DROP_OLDEST;
+	backlog->buffer = NULL;
+	backlog->size = 0;
+	backlog->used = 0;
+	backlog->head = 0;
+	backlog->tail = 0;
+	backlog->wrap = -1;
+	backlog->count = 0;
+	backlog->bytes = 0;
+	backlog->dropped_count = 0;
+	backlog->callback_count = 0;
+	backlog->written = 0;
+}
+
+// releases the SharedPacket object referenced by ENTRY, if any
+static void writer_backlog_release(WriterBacklogEntry *entry) {
+	if ((entry->flags & BACKLOG_ENTRY_FLAG_SHARED) != 0) {
+		shared_packet_release(*(SharedPacket **)writer_backlog_get_data(entry));
+	}
+}
+
+static void writer_backlog_destroy(WriterBacklog *backlog) {
+	int offset = backlog->head;
+	int i;
+	WriterBacklogEntry *entry;
+
+	for (i = 0; i < backlog->count + backlog->dropped_count; ++i) {
+		entry = writer_backlog_get_entry(backlog, offset);
+		offset = writer_backlog_get_next(backlog, offset);
+
+		if ((entry->flags & BACKLOG_ENTRY_FLAG_DROPPED) == 0) {
+			writer_backlog_release(entry);
+		}
+	}
+
+	if (backlog->policy == WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS) {
+		hash_table_destroy(&backlog->callback_index, NULL);
+	}
+
+	free(backlog->buffer);
+}
+
+// moves all entries of queued packets to the beginning of a new buffer of
+// SIZE bytes. entries of dropped packets are removed on the way.
+//
+// returns -1 on error (sets errno) or 0 on success
+static int writer_backlog_relocate(WriterBacklog *backlog, int size) {
+	uint8_t *buffer = malloc(size);
+	int offset = backlog->head;
+	int tail = 0;
+	int entry_size;
+	int i;
+	WriterBacklogEntry *entry;
+	WriterBacklogEntry *relocated;
+
+	if (buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	for (i = 0; i < backlog->count + backlog->dropped_count; ++i) {
+		entry = writer_backlog_get_entry(backlog, offset);
+		entry_size = writer_backlog_get_entry_size(writer_backlog_get_data_length(entry));
+
+		if ((entry->flags & BACKLOG_ENTRY_FLAG_DROPPED) == 0) {
+			relocated = (WriterBacklogEntry *)(buffer + tail);
+
+			memcpy(relocated, entry, entry_size);
+
+			if (writer_backlog_find_callback(backlog, writer_backlog_get_frame(entry)) == entry) {
+				writer_backlog_index_callback(backlog, relocated);
+			}
+
+			tail += entry_size;
+		}
+
+		offset = writer_backlog_get_next(backlog, offset);
+	}
+
+	free(backlog->buffer);
+
+	backlog->buffer = buffer;
+	backlog->size = size;
+	backlog->used = tail;
+	backlog->head = 0;
+	backlog->tail = tail;
+	backlog->wrap = -1;
+	backlog->dropped_count = 0;
+
+	return 0;
+}
+
+// moves all entries to a bigger buffer that has room for at least NEEDED
+// more bytes.
+//
+// returns -1 on error (sets errno) or 0 on success
+static int writer_backlog_grow(WriterBacklog *backlog, int needed) {
+	int size = backlog->size > 0 ? backlog->size * 2 : BACKLOG_MIN_SIZE;
+
+	while (size < backlog->used + needed) {
+		size *= 2;
+	}
+
+	return writer_backlog_relocate(backlog, size);
+}
+
+// appends an entry for FRAME of LENGTH bytes to the backlog. if SHARED_PACKET
+// is given then FRAME has to be its packet. the entry then references
+// SHARED_PACKET instead of storing a copy of FRAME.
+//
+// returns NULL on error (sets errno) or the new entry on success
+static WriterBacklogEntry *writer_backlog_push(WriterBacklog *backlog, const void *frame,
+                                               int length, SharedPacket *shared_packet) {
+	int size = writer_backlog_get_entry_size(shared_packet != NULL ? (int)sizeof(SharedPacket *) : length);
+	WriterBacklogEntry *entry;
+
+	if (backlog->wrap < 0) {
+		if (backlog->tail + size > backlog->size) {
+			if (size <= backlog->head) {
+				// skip the rest of the buffer and continue at its beginning
+				backlog->wrap = backlog->tail;
+				backlog->tail = 0;
+			} else if (writer_backlog_grow(backlog, size) < 0) {
+				return NULL;
+			}
+		}
+	} else if (backlog->tail + size > backlog->head &&
+	           writer_backlog_grow(backlog, size) < 0) {
+		return NULL;
+	}
+
+	entry = writer_backlog_get_entry(backlog, backlog->tail);
+	entry->timestamp = microtime();
+	entry->length = length;
+
+	if (shared_packet != NULL) {
+		entry->flags = BACKLOG_ENTRY_FLAG_SHARED;
+		*(SharedPacket **)writer_backlog_get_data(entry) = shared_packet_acquire(shared_packet);
+	} else {
+		entry->flags = 0;
+
+		memcpy(writer_backlog_get_data(entry), frame, length);
+	}
+
+	backlog->tail += size;
+	backlog->used += size;
+	backlog->bytes += entry->length;
+
+	++backlog->count;
+
+	return entry;
+}
+
+// removes the first entry from the backlog
+static void writer_backlog_remove_head(WriterBacklog *backlog) {
+	WriterBacklogEntry *entry = writer_backlog_get_entry(backlog, backlog->head);
+	int size = writer_backlog_get_entry_size(writer_backlog_get_data_length(entry));
+
+	backlog->used -= size;
+	backlog->head += size;
+
+	if (backlog->head == backlog->wrap) {
+		backlog->head = 0;
+		backlog->wrap = -1;
+	}
+}
+
+// removes the first packet from the backlog, as well as the entries of all
+// dropped packets following it
+static void writer_backlog_pop(WriterBacklog *backlog) {
+	WriterBacklogEntry *entry;
+
+	if (backlog->count == 0) {
+		return;
+	}
+
+	entry = writer_backlog_get_entry(backlog, backlog->head);
+
+	if (writer_backlog_is_coalescable(backlog, entry)) {
+		--backlog->callback_count;
+	}
+
+	writer_backlog_unindex_callback(backlog, entry);
+	writer_backlog_release(entry);
+
+	backlog->bytes -= entry->length;
+	backlog->written = 0;
+
+	writer_backlog_remove_head(backlog);
+
+	--backlog->count;
+
+	while (backlog->dropped_count > 0 &&
+	       (writer_backlog_get_entry(backlog, backlog->head)->flags & BACKLOG_ENTRY_FLAG_DROPPED) != 0) {
+		writer_backlog_remove_head(backlog);
+
+		--backlog->dropped_count;
+	}
+
+	if (backlog->count == 0) {
+		backlog->head = 0;
+		backlog->tail = 0;
+		backlog->wrap = -1;
+
+		// don't keep a big buffer around after a burst
+		if (backlog->size > BACKLOG_MAX_RETAINED_SIZE) {
+			free(backlog->buffer);
+
+			backlog->buffer = NULL;
+			backlog->size = 0;
+		}
+	}
+}
+
+// drops a queued packet. its entry is only marked as dropped, unless it is
+// the first one. the marked entries are removed once they reach the head of
+// the backlog or when the backlog is relocated
+static void writer_backlog_drop(WriterBacklog *backlog, WriterBacklogEntry *entry) {
+	if (writer_backlog_get_offset(backlog, entry) == backlog->head) {
+		writer_backlog_pop(backlog);
+
+		return;
+	}
+
+	if (writer_backlog_is_coalescable(backlog, entry)) {
+		--backlog->callback_count;
+	}
+
+	writer_backlog_unindex_callback(backlog, entry);
+	writer_backlog_release(entry);
+
+	entry->flags |= BACKLOG_ENTRY_FLAG_DROPPED;
+
+	backlog->bytes -= entry->length;
+
+	--backlog->count;
+	++backlog->dropped_count;
+
+	// don't let the entries of dropped packets pile up. if relocation fails
+	// then they are just kept around a bit longer
+	if (backlog->dropped_count > backlog->count) {
+		writer_backlog_relocate(backlog, backlog->size);
+	}
+}
+
+// replaces the frame of ENTRY with FRAME of LENGTH bytes in place, if
+// possible. if SHARED_PACKET is given then FRAME has to be its packet.
+//
+// returns true if the frame was replaced
+static bool writer_backlog_replace(WriterBacklog *backlog, WriterBacklogEntry *entry,
+                                   const void *frame, int length, SharedPacket *shared_packet) {
+	SharedPacket **slot;
+
+	if ((entry->flags & BACKLOG_ENTRY_FLAG_SHARED) != 0) {
+		if (shared_packet == NULL) {
+			return false;
+		}
+
+		slot = writer_backlog_get_data(entry);
+
+		shared_packet_acquire(shared_packet);
+		shared_packet_release(*slot);
+
+		*slot = shared_packet;
+
+		backlog->bytes += length - entry->length;
+		entry->length = length;
+
+		return true;
+	}
+
+	if (entry->length != length) {
+		return false;
+	}
+
+	memcpy(writer_backlog_get_data(entry), frame, length);
+
+	return true;
+}
+
+// returns the queued packet that should be dropped first according to the
+// backlog policy or NULL if no queued packet can be dropped. if there are no
+// callbacks to drop then the oldest droppable response is found without
+// scanning the whole backlog for callbacks
+static WriterBacklogEntry *writer_backlog_find_droppable(WriterBacklog *backlog) {
+	int offset = backlog->head;
+	int i;
+	WriterBacklogEntry *entry;
+	WriterBacklogEntry *response = NULL;
+	bool any_entry = backlog->policy == WRITER_BACKLOG_POLICY_DROP_OLDEST ||
+	                 backlog->callback_count == 0;
+
+	for (i = 0; i < backlog->count + backlog->dropped_count; ++i) {
+		entry = writer_backlog_get_entry(backlog, offset);
+		offset = writer_backlog_get_next(backlog, offset);
+
+		if ((entry->flags & BACKLOG_ENTRY_FLAG_DROPPED) != 0 ||
+		    writer_backlog_is_locked(backlog, entry)) {
+			continue;
+		}
+
+		if (any_entry || writer_backlog_is_coalescable(backlog, entry)) {
+			return entry;
+		}
+
+		if (response == NULL) {
+			response = entry;
+		}
+	}
+
+	return response;
+}
+
+static void writer_handle_write(void *opaque);
+
+static int writer_get_delay_bucket(uint64_t delay) {
+	int bucket = delay == 0 ? 0 : 64 - __builtin_clzll(delay);
+
+	if (bucket >= WRITER_DELAY_HISTOGRAM_SIZE) {
+		bucket = WRITER_DELAY_HISTOGRAM_SIZE - 1;
+	}
+
+	return bucket;
+}
+
+// returns the upper bound of the histogram bucket that contains the given
+// PERCENTILE of COUNT delays
+static uint64_t writer_get_histogram_percentile(uint64_t *histogram, uint64_t count,
+                                                int percentile) {
+	uint64_t rank = (count * (uint64_t)percentile + 99) / 100;
+	uint64_t sum = 0;
+	int bucket;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	for (bucket = 0; bucket < WRITER_DELAY_HISTOGRAM_SIZE - 1; ++bucket) {
+		sum += histogram[bucket];
+
+		if (sum >= rank) {
+			break;
+		}
+	}
+
+	return UINT64_C(1) << bucket;
+}
+
+static void writer_reset_slow_client_window(Writer *writer) {
+	memset(writer->slow_client_histogram, 0, sizeof(writer->slow_client_histogram));
+
+	writer->slow_client_count = 0;
+}
+
+// records how long a packet waited in the backlog before it was completely
+// written
+static void writer_record_delay(Writer *writer, uint64_t delay) {
+	WriterStatistics *statistics = &writer->statistics;
+	int bucket = writer_get_delay_bucket(delay);
+
+	++statistics->delayed_packets;
+	++statistics->delay_histogram[bucket];
+	statistics->total_delay += delay;
+
+	if (delay > statistics->max_delay) {
+		statistics->max_delay = delay;
+	}
+
+	if (writer->slow_client_threshold > 0) {
+		++writer->slow_client_histogram[bucket];
+		++writer->slow_client_count;
+	}
+}
+
+// cancels a pending flush before disconnecting the recipient, so that
+// writer_handle_flush cannot disconnect it a second time
+static void writer_disconnect_recipient(Writer *writer) {
+	event_cancel_flush(&writer->flush);
+
+	writer->recipient_disconnect(writer->opaque);
+}
+
+// checks if the 99th percentile of the queueing delay of the last
+// SLOW_CLIENT_WINDOW packets exceeds the slow client threshold. a stalled
+// recipient doesn't complete any packets anymore, therefore the recipient is
+// also too slow if the oldest queued packet is already waiting longer than the
+// threshold. the recipient is not disconnected here, so this can also be
+// called from writer_write.
+//
+// returns true if the recipient is too slow
+static bool writer_detect_slow_client(Writer *writer) {
+	uint64_t delay = 0;
+
+	if (writer->slow_client_threshold == 0) {
+		return false;
+	}
+
+	if (writer->slow_client_delay > 0) {
+		return true;
+	}
+
+	if (writer->slow_client_count >= SLOW_CLIENT_WINDOW) {
+		delay = writer_get_histogram_percentile(writer->slow_client_histogram,
+		                                        writer->slow_client_count, 99);
+
+		writer_reset_slow_client_window(writer);
+	}
+
+	if (delay <= writer->slow_client_threshold) {
+		delay = writer_get_backlog_age(writer);
+	}
+
+	if (delay <= writer->slow_client_threshold) {
+		return false;
+	}
+
+	writer->slow_client_delay = delay;
+
+	return true;
+}
+
+// disconnects the recipient if it is too slow. must only be called from the
+// event loop, not from writer_write.
+//
+// returns -1 if the recipient got disconnected (the Writer object must not be
+// used anymore in this case) or 0 otherwise
+static int writer_check_slow_client(Writer *writer) {
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+
+	if (!writer_detect_slow_client(writer)) {
+		return 0;
+	}
+
+	log_warn("%s is too slow to receive (queueing delay: %" PRIu64 " usec, threshold: %" PRIu64 " usec), disconnecting %s",
+	         writer->recipient_signature(recipient_signature, true, writer->opaque),
+	         writer->slow_client_delay, writer->slow_client_threshold,
+	         writer->recipient_name);
+
+	writer_disconnect_recipient(writer);
+
+	return -1;
+}
+
+static char *writer_get_signature(Writer *writer, char *signature, const void *frame, int length) {
+	if (writer->frame_signature != NULL) {
+		return writer->frame_signature(signature, frame, length);
+	}
+
+	return writer->packet_signature(signature, (Packet *)frame);
+}
+
+// calls the backpressure function if the backlog reached the high watermark
+// or if it went back down to the low watermark. the function must not
+// destroy the writer
+static void writer_check_watermarks(Writer *writer) {
+	WriterBacklog *backlog = &writer->backlog;
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+
+	if (writer->backpressure == NULL) {
+		return;
+	}
+
+	if (!writer->congested) {
+		if ((writer->high_watermark_count <= 0 || backlog->count < writer->high_watermark_count) &&
+		    (writer->high_watermark_bytes <= 0 || backlog->bytes < writer->high_watermark_bytes)) {
+			return;
+		}
+
+		log_debug("Write backlog for %s reached high watermark (count: %d, bytes: %d)",
+		          writer->recipient_signature(recipient_signature, false, writer->opaque),
+		          backlog->count, backlog->bytes);
+	} else {
+		if ((writer->high_watermark_count > 0 && backlog->count > writer->low_watermark_count) ||
+		    (writer->high_watermark_bytes > 0 && backlog->bytes > writer->low_watermark_bytes)) {
+			return;
+		}
+
+		log_debug("Write backlog for %s went down to low watermark (count: %d, bytes: %d)",
+		          writer->recipient_signature(recipient_signature, false, writer->opaque),
+		          backlog->count, backlog->bytes);
+	}
+
+	writer->congested = !writer->congested;
+
+	writer->backpressure(writer->congested, writer->backpressure_opaque);
+}
+
+static int writer_enable_write_events(Writer *writer) {
+	if (writer->write_events_enabled) {
+		return 0;
+	}
+
+	if (event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                        0, EVENT_WRITE, writer_handle_write, writer) < 0) {
+		return -1;
+	}
+
+	writer->write_events_enabled = true;
+
+	++writer->statistics.write_event_toggles;
+
+	return 0;
+}
+
+static void writer_disable_write_events(Writer *writer) {
+	if (!writer->write_events_enabled) {
+		return;
+	}
+
+	event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                    EVENT_WRITE, 0, NULL, NULL);
+
+	writer->write_events_enabled = false;
+
+	++writer->statistics.write_event_toggles;
+}
+
+// writes as many queued packets as the IO object accepts with a single
+// vectored write. fully written packets are removed from the backlog, the
+// written part of the first remaining packet is remembered in the backlog.
+//
+// returns -1 if the recipient got disconnected (the Writer object must not be
+// used anymore in this case) or 0 otherwise
+static int writer_write_backlog(Writer *writer) {
+	WriterBacklog *backlog = &writer->backlog;
+	WriterBacklogEntry *entry;
+	IOVector vectors[IO_MAX_VECTOR_COUNT];
+	int count = 0;
+	int i;
+	int offset;
+	int written;
 	int remaining_length;
+	int length = 0;
 	int rc;
+	uint64_t now;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 
-	if (writer->backlog.count == 0) {
-		return;
+	if (backlog->count == 0) {
+		return 0;
 	}
 
-	// write remaining packet data
-	partial_packet = queue_peek(&writer->backlog);
-	remaining_data = (uint8_t *)&partial_packet->packet + partial_packet->written;
-	remaining_length = (int)partial_packet->packet.header.length - partial_packet->written;
+	// collect remaining packet data
+	offset = backlog->head;
+	written = backlog->written;
 
-	if (remaining_length > 0) {
-		rc = io_write(writer->io, remaining_data, remaining_length);
+	for (i = 0; i < backlog->count + backlog->dropped_count && count < IO_MAX_VECTOR_COUNT; ++i) {
+		entry = writer_backlog_get_entry(backlog, offset);
+		offset = writer_backlog_get_next(backlog, offset);
 
-		if (rc < 0) {
-			log_error("Could not send queued %s (%s) to %s, disconnecting %s: %s (%d)",
-			          writer->packet_type,
-			          writer->packet_signature(packet_signature, &partial_packet->packet),
-			          writer->recipient_signature(recipient_signature, false, writer->opaque),
-			          writer->recipient_name,
-			          get_errno_name(errno), errno);
+		if ((entry->flags & BACKLOG_ENTRY_FLAG_DROPPED) != 0) {
+			continue;
+		}
 
-			writer->recipient_disconnect(writer->opaque);
+		vectors[count].buffer = (uint8_t *)writer_backlog_get_frame(entry) + written;
+		vectors[count].length = entry->length - written;
+		length += vectors[count].length;
 
-			return;
+		++count;
+
+		written = 0;
+	}
+
+	// cannot happen, the backlog contains at least one queued packet
+	if (count == 0) {
+		return 0;
+	}
+
+	rc = io_write_vector(writer->io, vectors, count);
+
+	if (rc < 0) {
+		if (errno_would_block()) {
+			return 0;
 		}
 
-		partial_packet->written += rc;
+		entry = writer_backlog_get_entry(backlog, backlog->head);
+
+		log_error("Could not send queued %s (%s) to %s, disconnecting %s: %s (%d)",
+		          writer->packet_type,
+		          writer_get_signature(writer, packet_signature, writer_backlog_get_frame(entry), entry->length),
+		          writer->recipient_signature(recipient_signature, false, writer->opaque),
+		          writer->recipient_name,
+		          get_errno_name(errno), errno);
+
+		writer_disconnect_recipient(writer);
+
+		return -1;
 	}
 
-	// if packet was no completely written then don't remove it from the backlog yet
-	if (partial_packet->written < (int)partial_packet->packet.header.length) {
-		return;
+	writer->statistics.bytes_sent += rc;
+
+	if (rc < length) {
+		++writer->statistics.partial_writes;
 	}
 
-	log_packet_debug("Sent queued %s (%s) to %s, %d %s(s) left in write backlog",
-	                 writer->packet_type,
-	                 writer->packet_signature(packet_signature, &partial_packet->packet),
-	                 writer->recipient_signature(recipient_signature, false, writer->opaque),
-	                 writer->backlog.count - 1,
-	                 writer->packet_type);
+	now = microtime();
+
+	// distribute written bytes over the packets in backlog order and remove
+	// all completely written packets from the backlog
+	while (backlog->count > 0) {
+		entry = writer_backlog_get_entry(backlog, backlog->head);
+		remaining_length = entry->length - backlog->written;
 
-	queue_pop(&writer->backlog, NULL);
+		if (remaining_length > rc) {
+			// packet was not completely written, keep it in the backlog
+			backlog->written += rc;
+
+			break;
+		}
+
+		rc -= remaining_length;
+
+		++writer->statistics.packets_sent;
+
+		writer_record_delay(writer, now - entry->timestamp);
+
+		log_packet_debug("Sent queued %s (%s) to %s, %d %s(s) left in write backlog",
+		                 writer->packet_type,
+		                 writer_get_signature(writer, packet_signature, writer_backlog_get_frame(entry), entry->length),
+		                 writer->recipient_signature(recipient_signature, false, writer->opaque),
+		                 backlog->count - 1,
+		                 writer->packet_type);
+
+		writer_backlog_pop(backlog);
+	}
+
+	writer_check_watermarks(writer);
+
+	return writer_check_slow_client(writer);
+}
+
+static void writer_handle_write(void *opaque) {
+	Writer *writer = opaque;
+
+	if (writer_write_backlog(writer) < 0) {
+		return;
+	}
 
 	if (writer->backlog.count == 0) {
 		// last queued packet handled, deregister for write events
-		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
-		                    EVENT_WRITE, 0, NULL, NULL);
+		writer_disable_write_events(writer);
 	}
 }
 
-static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int written) {
-	PartialPacket *queued_partial_packet;
+// called at the end of the event loop iteration in which the first packet was
+// pushed to the backlog of a corked writer
+static void writer_handle_flush(void *opaque) {
+	Writer *writer = opaque;
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+
+	// a slow recipient was detected in writer_write, disconnect it now
+	if (writer->slow_client_delay > 0) {
+		writer_check_slow_client(writer);
+
+		return;
+	}
+
+	// the backlog is already written as soon as the recipient is ready
+	if (writer->write_events_enabled) {
+		return;
+	}
+
+	if (writer_write_backlog(writer) < 0) {
+		return;
+	}
+
+	// recipient is not ready to receive the rest, wait for write events
+	if (writer->backlog.count > 0 && writer_enable_write_events(writer) < 0) {
+		log_error("Could not wait for %s to become ready to receive, disconnecting %s: %s (%d)",
+		          writer->recipient_signature(recipient_signature, false, writer->opaque),
+		          writer->recipient_name,
+		          get_errno_name(errno), errno);
+
+		writer_disconnect_recipient(writer);
+	}
+}
+
+// if SHARED_PACKET is given then FRAME has to be its packet
+static int writer_push_frame_to_backlog(Writer *writer, const void *frame, int length,
+                                        SharedPacket *shared_packet, int written) {
+	WriterBacklogEntry *entry;
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	uint32_t packets_to_drop;
 
+	// replace an older queued instance of the same callback
+	entry = writer_backlog_find_callback(&writer->backlog, (Packet *)frame);
+
+	if (entry != NULL && !writer_backlog_is_locked(&writer->backlog, entry)) {
+		if (writer_backlog_replace(&writer->backlog, entry, frame, length, shared_packet)) {
+			++writer->coalesced_packets;
+
+			log_packet_debug("%s is not ready to receive, replaced queued %s with %s (%s) in write backlog (count: %d)",
+			                 writer->recipient_signature(recipient_signature, true, writer->opaque),
+			                 writer->packet_type, writer->packet_type,
+			                 writer_get_signature(writer, packet_signature, frame, length),
+			                 writer->backlog.count);
+
+			writer_check_watermarks(writer);
+
+			return 0;
+		}
+
+		// cannot be replaced in place, drop it and push the new one
+		writer_backlog_drop(&writer->backlog, entry);
+
+		++writer->coalesced_packets;
+	}
+
 	log_packet_debug("%s is not ready to receive, pushing %s to write backlog (count: %d + 1)",
 	                 writer->recipient_signature(recipient_signature, true, writer->opaque),
 	                 writer->packet_type, writer->backlog.count);
@@ -120,16 +901,22 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 		writer->dropped_packets += packets_to_drop;
 
 		while (writer->backlog.count >= MAX_QUEUED_WRITES) {
-			queue_pop(&writer->backlog, NULL);
+			entry = writer_backlog_find_droppable(&writer->backlog);
+
+			if (entry == NULL) {
+				break;
+			}
+
+			writer_backlog_drop(&writer->backlog, entry);
 		}
 	}
 
-	queued_partial_packet = queue_push(&writer->backlog);
+	entry = writer_backlog_push(&writer->backlog, frame, length, shared_packet);
 
-	if (queued_partial_packet == NULL) {
+	if (entry == NULL) {
 		log_error("Could not push %s (%s) to write backlog for %s, discarding %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_signature(writer, packet_signature, frame, length),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->packet_type,
 		          get_errno_name(errno), errno);
@@ -137,16 +924,37 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 		return -1;
 	}
 
-	memcpy(&queued_partial_packet->packet, packet, packet->header.length);
-	queued_partial_packet->written = written;
+	if (writer_backlog_is_coalescable(&writer->backlog, entry)) {
+		++writer->backlog.callback_count;
+	}
+
+	// if the callback cannot be indexed then it is just not coalesced
+	writer_backlog_index_callback(&writer->backlog, entry);
 
 	if (writer->backlog.count == 1) {
-		// first queued packet, register for write events
-		if (event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
-		                        0, EVENT_WRITE, writer_handle_write, writer) < 0) {
-			// FIXME: how to handle this error?
-			return -1;
-		}
+		writer->backlog.written = written;
+	}
+
+	writer_check_watermarks(writer);
+
+	// the caller doesn't expect the recipient to be disconnected during
+	// writer_write, disconnect it at the end of the event loop iteration
+	if (writer_detect_slow_client(writer)) {
+		event_schedule_flush(&writer->flush);
+
+		return 0;
+	}
+
+	if (writer->write_events_enabled) {
+		return 0;
+	}
+
+	if (writer->cork) {
+		// first staged packet of this iteration, write the backlog at its end
+		event_schedule_flush(&writer->flush);
+	} else if (writer_enable_write_events(writer) < 0) {
+		// FIXME: how to handle this error?
+		return -1;
 	}
 
 	return 0;
@@ -162,21 +970,51 @@ int writer_create(Writer *writer, IO *io,
 	writer->io = io;
 	writer->packet_type = packet_type;
 	writer->packet_signature = packet_signature;
+	writer->frame_signature = NULL;
 	writer->recipient_name = recipient_name;
 	writer->recipient_signature = recipient_signature;
 	writer->recipient_disconnect = recipient_disconnect;
 	writer->opaque = opaque;
 	writer->dropped_packets = 0;
+	writer->coalesced_packets = 0;
 	writer->last_dropped_packets_warning = 0;
+	writer->cork = false;
+	writer->write_events_enabled = false;
+	writer->high_watermark_count = 0;
+	writer->low_watermark_count = 0;
+	writer->high_watermark_bytes = 0;
+	writer->low_watermark_bytes = 0;
+	writer->backpressure = NULL;
+	writer->backpressure_opaque = NULL;
+	writer->congested = false;
+	writer->slow_client_threshold = 0;
+	writer->slow_client_delay = 0;
 
-	// create write queue
-	if (queue_create(&writer->backlog, sizeof(PartialPacket)) < 0) {
-		log_error("Could not create backlog: %s (%d)",
-		          get_errno_name(errno), errno);
+	writer_reset_statistics(writer);
+	writer_reset_slow_client_window(writer);
+	writer_backlog_create(&writer->backlog);
+	event_flush_create(&writer->flush, writer_handle_flush, writer);
 
+	return 0;
+}
+
+// creates a Writer object for frames of any length that are not Packets, e.g.
+// mesh frames. FRAME_SIGNATURE gets a buffer of PACKET_MAX_SIGNATURE_LENGTH
+// bytes. use writer_write_frame to write frames
+int writer_create_framed(Writer *writer, IO *io,
+                         const char *frame_type,
+                         WriterFrameSignatureFunction frame_signature,
+                         const char *recipient_name,
+                         WriterRecipientSignatureFunction recipient_signature,
+                         WriterRecipientDisconnectFunction recipient_disconnect,
+                         void *opaque) {
+	if (writer_create(writer, io, frame_type, NULL, recipient_name,
+	                  recipient_signature, recipient_disconnect, opaque) < 0) {
 		return -1;
 	}
 
+	writer->frame_signature = frame_signature;
+
 	return 0;
 }
 
@@ -188,24 +1026,23 @@ void writer_destroy(Writer *writer) {
 		         writer->recipient_signature(recipient_signature, false, writer->opaque),
 		         writer->backlog.count,
 		         writer->packet_type);
-
-		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
-		                    EVENT_WRITE, 0, NULL, NULL);
 	}
 
-	queue_destroy(&writer->backlog, NULL);
+	event_cancel_flush(&writer->flush);
+	writer_disable_write_events(writer);
+	writer_backlog_destroy(&writer->backlog);
 }
 
-// returns -1 on error, 0 if the packet was completely written and 1 if the
-// packet was completely or partly pushed to the backlog
-int writer_write(Writer *writer, Packet *packet) {
+// if SHARED_PACKET is given then FRAME has to be its packet
+static int writer_send(Writer *writer, const void *frame, int length, SharedPacket *shared_packet) {
 	int rc;
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 
-	// there is already a backlog, push complete packet to backlog
-	if (writer->backlog.count > 0) {
-		if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+	// there is already a backlog or the packet should be written at the end
+	// of the current event loop iteration, push complete packet to backlog
+	if (writer->backlog.count > 0 || writer->cork) {
+		if (writer_push_frame_to_backlog(writer, frame, length, shared_packet, 0) < 0) {
 			return -1;
 		}
 
@@ -213,12 +1050,12 @@ int writer_write(Writer *writer, Packet *packet) {
 	}
 
 	// if there is no backlog, try to write
-	rc = io_write(writer->io, packet, packet->header.length);
+	rc = io_write(writer->io, frame, length);
 
 	if (rc < 0) {
 		if (errno_would_block()) {
 			// if write failed with EWOULDBLOCK, push complete packet to backlog
-			if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+			if (writer_push_frame_to_backlog(writer, frame, length, shared_packet, 0) < 0) {
 				return -1;
 			}
 
@@ -228,22 +1065,190 @@ int writer_write(Writer *writer, Packet *packet) {
 		// otherwise give up and disconnect the recipient
 		log_error("Could not send %s (%s) to %s, disconnecting %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_signature(writer, packet_signature, frame, length),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->recipient_name,
 		          get_errno_name(errno), errno);
 
-		writer->recipient_disconnect(writer->opaque);
+		writer_disconnect_recipient(writer);
 
 		return -1;
-	} else if (rc < packet->header.length) {
+	}
+
+	writer->statistics.bytes_sent += rc;
+
+	if (rc < length) {
+		++writer->statistics.partial_writes;
+
 		// packet was not written completely, push remaining packet to backlog
-		if (writer_push_packet_to_backlog(writer, packet, rc) < 0) {
+		if (writer_push_frame_to_backlog(writer, frame, length, shared_packet, rc) < 0) {
 			return -1;
 		}
 
 		return 1;
 	}
 
+	++writer->statistics.packets_sent;
+
+	writer_record_delay(writer, 0);
+
 	return 0;
 }
+
+// returns -1 on error, 0 if the packet was completely written and 1 if the
+// packet was completely or partly pushed to the backlog
+int writer_write(Writer *writer, Packet *packet) {
+	return writer_send(writer, packet, packet->header.length, NULL);
+}
+
+// like writer_write, but if the packet has to be pushed to the backlog then
+// the backlog references SHARED_PACKET instead of storing a copy of it. this
+// allows to broadcast a packet to many writers without copying it for each
+// of them. the caller keeps its own reference to SHARED_PACKET
+int writer_write_shared(Writer *writer, SharedPacket *shared_packet) {
+	return writer_send(writer, &shared_packet->packet, shared_packet->packet.header.length,
+	                   shared_packet);
+}
+
+// writes FRAME of LENGTH bytes as is. if it has to be pushed to the backlog
+// then only LENGTH bytes are stored. returns the same as writer_write
+int writer_write_frame(Writer *writer, const void *frame, int length) {
+	return writer_send(writer, frame, length, NULL);
+}
+
+// in cork mode writer_write doesn't try to write each packet immediately, but
+// stages it in the backlog. all packets staged during an event loop iteration
+// are then written at its end with as few writes as possible. the backlog of
+// a writer that leaves cork mode is still written at the end of the iteration
+void writer_set_cork(Writer *writer, bool cork) {
+	writer->cork = cork;
+}
+
+// returns -1 on error (sets errno) or 0 on success
+int writer_set_backlog_policy(Writer *writer, WriterBacklogPolicy policy) {
+	WriterBacklog *backlog = &writer->backlog;
+	int offset = backlog->head;
+	int i;
+	WriterBacklogEntry *entry;
+
+	if (backlog->policy == policy) {
+		return 0;
+	}
+
+	// callbacks can only be recognized in Packets
+	if (policy == WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS && writer->frame_signature != NULL) {
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	if (backlog->policy == WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS) {
+		hash_table_destroy(&backlog->callback_index, NULL);
+	}
+
+	backlog->policy = policy;
+	backlog->callback_count = 0;
+
+	if (policy != WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS) {
+		return 0;
+	}
+
+	if (hash_table_create(&backlog->callback_index, 0) < 0) {
+		backlog->policy = WRITER_BACKLOG_POLICY_DROP_OLDEST;
+
+		return -1;
+	}
+
+	// index already queued callbacks, the newest one of each kind wins
+	for (i = 0; i < backlog->count + backlog->dropped_count; ++i) {
+		entry = writer_backlog_get_entry(backlog, offset);
+		offset = writer_backlog_get_next(backlog, offset);
+
+		if ((entry->flags & BACKLOG_ENTRY_FLAG_DROPPED) != 0) {
+			continue;
+		}
+
+		if (writer_backlog_index_callback(backlog, entry) < 0) {
+			hash_table_destroy(&backlog->callback_index, NULL);
+
+			backlog->policy = WRITER_BACKLOG_POLICY_DROP_OLDEST;
+			backlog->callback_count = 0;
+
+			return -1;
+		}
+
+		if (writer_backlog_is_coalescable(backlog, entry)) {
+			++backlog->callback_count;
+		}
+	}
+
+	return 0;
+}
+
+// sets the watermarks for the backpressure FUNCTION. FUNCTION is called with
+// CONGESTED set to true once the backlog holds at least HIGH_COUNT packets or
+// HIGH_BYTES bytes. it is called with CONGESTED set to false once the backlog
+// went back down to at most LOW_COUNT packets and LOW_BYTES bytes. this
+// allows a producer to pause while the recipient is not keeping up, instead
+// of producing packets that would be dropped. a high watermark of 0 disables
+// the corresponding check, a FUNCTION of NULL disables backpressure
+void writer_set_watermarks(Writer *writer, int high_count, int low_count,
+                           int high_bytes, int low_bytes,
+                           WriterBackpressureFunction function, void *opaque) {
+	writer->high_watermark_count = high_count;
+	writer->low_watermark_count = low_count;
+	writer->high_watermark_bytes = high_bytes;
+	writer->low_watermark_bytes = low_bytes;
+	writer->backpressure = function;
+	writer->backpressure_opaque = opaque;
+	writer->congested = false;
+
+	writer_check_watermarks(writer);
+}
+
+// returns the number of queued packets
+int writer_get_backlog_count(Writer *writer) {
+	return writer->backlog.count;
+}
+
+// returns the number of bytes of all queued packets
+int writer_get_backlog_bytes(Writer *writer) {
+	return writer->backlog.bytes;
+}
+
+// returns the time in microseconds the oldest queued packet is waiting or 0
+// if the backlog is empty
+uint64_t writer_get_backlog_age(Writer *writer) {
+	WriterBacklog *backlog = &writer->backlog;
+
+	if (backlog->count == 0) {
+		return 0;
+	}
+
+	return microtime() - writer_backlog_get_entry(backlog, backlog->head)->timestamp;
+}
+
+void writer_reset_statistics(Writer *writer) {
+	memset(&writer->statistics, 0, sizeof(writer->statistics));
+}
+
+// returns the upper bound (in microseconds) of the given PERCENTILE (0 to 100)
+// of the queueing delay of all packets written since the statistics were
+// reset. packets written directly without going through the backlog count
+// with a delay of 0
+uint64_t writer_get_delay_percentile(Writer *writer, int percentile) {
+	return writer_get_histogram_percentile(writer->statistics.delay_histogram,
+	                                       writer->statistics.delayed_packets,
+	                                       percentile);
+}
+
+// if the 99th percentile of the queueing delay of a window of packets or the
+// age of the oldest queued packet exceeds THRESHOLD (in microseconds) then the
+// recipient is considered to be too slow and gets disconnected. a THRESHOLD
+// of 0 disables slow client detection
+void writer_set_slow_client_threshold(Writer *writer, uint64_t threshold) {
+	writer->slow_client_threshold = threshold;
+	writer->slow_client_delay = 0;
+
+	writer_reset_slow_client_window(writer);
+}
@@ -23,37 +23,100 @@
 #define DAEMONLIB_WRITER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "event.h"
+#include "hash_table.h"
 #include "io.h"
 #include "packet.h"
-#include "queue.h"
+#include "shared_packet.h"
 
 #define WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH 256
 
+// bucket 0 counts delays below 1 microsecond, bucket N (N > 0) counts delays
+// in [2^(N-1), 2^N) microseconds and the last bucket also counts all longer
+// delays
+#define WRITER_DELAY_HISTOGRAM_SIZE 32
+
 typedef char *(*WriterPacketSignatureFunction)(char *signature, Packet *packet);
+typedef char *(*WriterFrameSignatureFunction)(char *signature, const void *frame, int length);
 typedef char *(*WriterRecipientSignatureFunction)(char *signature, bool upper, void *opaque);
 typedef void (*WriterRecipientDisconnectFunction)(void *opaque);
+typedef void (*WriterBackpressureFunction)(bool congested, void *opaque);
+
+typedef enum {
+	// if the backlog is full then the oldest packet is dropped
+	WRITER_BACKLOG_POLICY_DROP_OLDEST = 0,
+
+	// a callback replaces an older queued callback with the same UID and
+	// function ID. if the backlog is full then the oldest callback is dropped.
+	// responses are only dropped if there are no callbacks left to drop
+	WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS
+} WriterBacklogPolicy;
 
 typedef struct {
-	Packet packet;
-	int written;
-} PartialPacket;
+	uint64_t timestamp; // in microseconds, when the packet was pushed
+	int length; // bytes of the frame following the entry
+	uint32_t flags;
+} WriterBacklogEntry;
+
+typedef struct {
+	WriterBacklogPolicy policy;
+	uint8_t *buffer;
+	int size; // allocated bytes
+	int used; // bytes used by entries
+	int head; // offset of the first entry
+	int tail; // offset behind the last entry
+	int wrap; // offset behind the last entry before the buffer end or -1
+	int count; // number of queued packets
+	int bytes; // bytes of all queued frames
+	int dropped_count; // number of entries of dropped packets not removed yet
+	int callback_count; // number of queued coalescable callbacks, only for WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS
+	int written; // bytes of the first packet that are already written
+	HashTable callback_index; // (uid, function_id) -> WriterBacklogEntry, only for WRITER_BACKLOG_POLICY_COALESCE_CALLBACKS
+} WriterBacklog;
+
+typedef struct {
+	uint64_t bytes_sent;
+	uint64_t packets_sent;
+	uint64_t partial_writes; // writes that didn't accept all offered bytes
+	uint64_t write_event_toggles; // EVENT_WRITE registration changes
+	uint64_t delayed_packets; // number of delays in the histogram
+	uint64_t total_delay; // in microseconds
+	uint64_t max_delay; // in microseconds
+	uint64_t delay_histogram[WRITER_DELAY_HISTOGRAM_SIZE]; // queueing delay
+} WriterStatistics;
 
 typedef struct {
 	IO *io;
-	const char *packet_type; // for display purpose
+	const char *packet_type; // for display purpose, frame type for framed writers
 	WriterPacketSignatureFunction packet_signature;
+	WriterFrameSignatureFunction frame_signature; // only for framed writers
 	const char *recipient_name; // for display purpose
 	WriterRecipientSignatureFunction recipient_signature;
 	WriterRecipientDisconnectFunction recipient_disconnect;
 	void *opaque;
 	uint32_t dropped_packets;
+	uint32_t coalesced_packets;
 	uint64_t last_dropped_packets_warning;
-	Queue backlog;
+	WriterBacklog backlog;
+	bool cork; // see writer_set_cork
+	bool write_events_enabled;
+	EventFlush flush;
+	int high_watermark_count; // packets, 0 = disabled
+	int low_watermark_count; // packets
+	int high_watermark_bytes; // bytes, 0 = disabled
+	int low_watermark_bytes; // bytes
+	WriterBackpressureFunction backpressure;
+	void *backpressure_opaque;
+	bool congested;
+	WriterStatistics statistics;
+	uint64_t slow_client_threshold; // in microseconds, 0 = disabled
+	int slow_client_count; // number of delays in the window histogram
+	uint64_t slow_client_histogram[WRITER_DELAY_HISTOGRAM_SIZE];
+	uint64_t slow_client_delay; // in microseconds, 0 = not detected yet, disconnect is deferred to writer_handle_flush
 } Writer;
 
-// FIXME: rework this to work for mesh packets as well
-
 int writer_create(Writer *writer, IO *io,
                   const char *packet_type,
                   WriterPacketSignatureFunction packet_signature,
@@ -61,8 +124,31 @@ int writer_create(Writer *writer, IO *io,
                   WriterRecipientSignatureFunction recipient_signature,
                   WriterRecipientDisconnectFunction recipient_disconnect,
                   void *opaque);
+int writer_create_framed(Writer *writer, IO *io,
+                         const char *frame_type,
+                         WriterFrameSignatureFunction frame_signature,
+                         const char *recipient_name,
+                         WriterRecipientSignatureFunction recipient_signature,
+                         WriterRecipientDisconnectFunction recipient_disconnect,
+                         void *opaque);
 void writer_destroy(Writer *writer);
 
 int writer_write(Writer *writer, Packet *packet);
+int writer_write_shared(Writer *writer, SharedPacket *shared_packet);
+int writer_write_frame(Writer *writer, const void *frame, int length);
+
+void writer_set_cork(Writer *writer, bool cork);
+int writer_set_backlog_policy(Writer *writer, WriterBacklogPolicy policy);
+void writer_set_watermarks(Writer *writer, int high_count, int low_count,
+                           int high_bytes, int low_bytes,
+                           WriterBackpressureFunction function, void *opaque);
+
+int writer_get_backlog_count(Writer *writer);
+int writer_get_backlog_bytes(Writer *writer);
+uint64_t writer_get_backlog_age(Writer *writer);
+
+void writer_reset_statistics(Writer *writer);
+uint64_t writer_get_delay_percentile(Writer *writer, int percentile);
+void writer_set_slow_client_threshold(Writer *writer, uint64_t threshold);
 
 #endif // DAEMONLIB_WRITER_H